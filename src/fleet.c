@@ -0,0 +1,646 @@
+/**
+ * librouteros - src/fleet.c
+ * Copyright (C) 2026  agent
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+ * OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ *
+ * Authors:
+ *   agent <agent at local>
+ **/
+
+#ifndef _ISOC99_SOURCE
+# define _ISOC99_SOURCE
+#endif
+
+#ifndef _POSIX_C_SOURCE
+# define _POSIX_C_SOURCE 200112L
+#endif
+
+#include "config.h"
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <assert.h>
+#include <unistd.h>
+#include <poll.h>
+
+#if HAVE_SYS_EPOLL_H
+# include <sys/epoll.h>
+#endif
+
+#include "routeros_api.h"
+#include "ros_util.h"
+
+#define ROS_FLEET_EVENTS_MAX 64
+
+/*
+ * Private data types
+ */
+struct fleet_query_s;
+typedef struct fleet_query_s fleet_query_t;
+struct fleet_query_s
+{
+	char *command;
+	size_t args_num;
+	char **args;
+
+	ros_reply_handler_t handler;
+	void *user_data;
+
+	fleet_query_t *next;
+};
+
+struct ros_fleet_host_s
+{
+	ros_fleet_t *fleet;
+
+	char *node;
+	char *service;
+	char *username;
+	char *password;
+
+	ros_fleet_done_handler_t done_handler;
+	void *user_data;
+
+	fleet_query_t *queries_head;
+	fleet_query_t *queries_tail;
+
+	/* State of the current sweep. */
+	ros_connection_t *connection;
+	_Bool queries_sent;
+	/* Zero means "no deadline". */
+	uint64_t deadline;
+	/* File descriptor and events watched for this host. */
+	int fd;
+	int events;
+
+	/* List of all hosts. */
+	ros_fleet_host_t *next;
+	/* List of active hosts, i.e. hosts with a connection. */
+	ros_fleet_host_t *active_prev;
+	ros_fleet_host_t *active_next;
+};
+
+struct ros_fleet_s
+{
+	ros_connect_opts_t connect_opts;
+	unsigned int max_connections;
+
+	ros_fleet_host_t *hosts_head;
+	ros_fleet_host_t *hosts_tail;
+
+	ros_fleet_host_t *active_head;
+	unsigned int active_num;
+
+	/* Only valid within ros_fleet_run. */
+	int epoll_fd;
+};
+
+/*
+ * Private functions
+ */
+static void fleet_strfree (char *s) /* {{{ */
+{
+	if (s == NULL)
+		return;
+
+	/* May contain a password. */
+	memset (s, 0, strlen (s));
+	free (s);
+} /* }}} void fleet_strfree */
+
+static void fleet_query_free (fleet_query_t *q) /* {{{ */
+{
+	size_t i;
+
+	if (q == NULL)
+		return;
+
+	for (i = 0; i < q->args_num; i++)
+		fleet_strfree (q->args[i]);
+	free (q->args);
+	free (q->command);
+	free (q);
+} /* }}} void fleet_query_free */
+
+static void fleet_deadline_set (ros_fleet_host_t *h, /* {{{ */
+		unsigned int timeout)
+{
+	if (timeout == 0)
+		h->deadline = 0;
+	else
+		h->deadline = clock_now_ms () + (((uint64_t) timeout) * 1000);
+} /* }}} void fleet_deadline_set */
+
+/* Makes the event loop watch the connection of "h" for the events it is
+ * waiting for. */
+static int fleet_watch (ros_fleet_host_t *h) /* {{{ */
+{
+	int fd = ros_connection_fd (h->connection);
+	int events = ros_connection_events (h->connection);
+#if HAVE_SYS_EPOLL_H
+	struct epoll_event ev;
+	int status;
+
+	/* While connecting, the connection may replace its socket by one with
+	 * the same number, which is not registered anymore. */
+	if ((fd == h->fd) && (events == h->events)
+			&& (ros_connection_state (h->connection) != ROS_STATE_CONNECTING))
+		return (0);
+
+	memset (&ev, 0, sizeof (ev));
+	ev.events = ((events & ROS_WANT_READ) ? EPOLLIN : 0)
+		| ((events & ROS_WANT_WRITE) ? EPOLLOUT : 0);
+	ev.data.ptr = h;
+
+	if ((h->fd >= 0) && (h->fd != fd))
+		epoll_ctl (h->fleet->epoll_fd, EPOLL_CTL_DEL, h->fd, NULL);
+
+	status = epoll_ctl (h->fleet->epoll_fd, EPOLL_CTL_MOD, fd, &ev);
+	if ((status != 0) && (errno == ENOENT))
+		status = epoll_ctl (h->fleet->epoll_fd, EPOLL_CTL_ADD, fd, &ev);
+	if (status != 0)
+		return (errno);
+#endif
+
+	h->fd = fd;
+	h->events = events;
+	return (0);
+} /* }}} int fleet_watch */
+
+static void fleet_unwatch (ros_fleet_host_t *h) /* {{{ */
+{
+#if HAVE_SYS_EPOLL_H
+	if (h->fd >= 0)
+		epoll_ctl (h->fleet->epoll_fd, EPOLL_CTL_DEL, h->fd, NULL);
+#endif
+	h->fd = -1;
+	h->events = 0;
+} /* }}} void fleet_unwatch */
+
+/* Ends the sweep of one host and reports the result. */
+static void fleet_host_finish (ros_fleet_host_t *h, int status) /* {{{ */
+{
+	ros_fleet_t *f = h->fleet;
+
+	fleet_unwatch (h);
+	ros_disconnect (h->connection);
+	h->connection = NULL;
+
+	if (h->active_prev == NULL)
+		f->active_head = h->active_next;
+	else
+		h->active_prev->active_next = h->active_next;
+	if (h->active_next != NULL)
+		h->active_next->active_prev = h->active_prev;
+	h->active_prev = NULL;
+	h->active_next = NULL;
+	f->active_num--;
+
+	if (h->done_handler != NULL)
+		(*h->done_handler) (h->node, status, h->user_data);
+} /* }}} void fleet_host_finish */
+
+static int fleet_host_start (ros_fleet_host_t *h) /* {{{ */
+{
+	ros_fleet_t *f = h->fleet;
+	int status;
+
+	h->connection = ros_connect_start (h->node, h->service,
+			h->username, h->password, &f->connect_opts);
+	if (h->connection == NULL)
+	{
+		status = errno;
+		if (h->done_handler != NULL)
+			(*h->done_handler) (h->node, status, h->user_data);
+		return (status);
+	}
+
+	h->queries_sent = 0;
+	h->fd = -1;
+	h->events = 0;
+	fleet_deadline_set (h, f->connect_opts.connect_timeout);
+
+	h->active_prev = NULL;
+	h->active_next = f->active_head;
+	if (f->active_head != NULL)
+		f->active_head->active_prev = h;
+	f->active_head = h;
+	f->active_num++;
+
+	status = fleet_watch (h);
+	if (status != 0)
+		fleet_host_finish (h, status);
+
+	return (status);
+} /* }}} int fleet_host_start */
+
+/* Sends all commands of "h" once the login has completed and finishes the
+ * host once all of them have been answered. */
+static void fleet_host_update (ros_fleet_host_t *h) /* {{{ */
+{
+	ros_connection_t *c = h->connection;
+	fleet_query_t *q;
+	int status;
+
+	if (ros_connection_state (c) == ROS_STATE_FAILED)
+	{
+		fleet_host_finish (h, ros_connection_process (c, 0));
+		return;
+	}
+	else if (ros_connection_state (c) != ROS_STATE_READY)
+	{
+		status = fleet_watch (h);
+		if (status != 0)
+			fleet_host_finish (h, status);
+		return;
+	}
+
+	if (!h->queries_sent)
+	{
+		h->queries_sent = 1;
+		for (q = h->queries_head; q != NULL; q = q->next)
+		{
+			status = ros_query_start (c, q->command,
+					q->args_num, (const char * const *) q->args,
+					q->handler, q->user_data);
+			if (status != 0)
+			{
+				fleet_host_finish (h, status);
+				return;
+			}
+		}
+	}
+
+	/* Handlers may have sent further commands. */
+	if ((ros_query_pending (c) == 0)
+			&& ((ros_connection_events (c) & ROS_WANT_WRITE) == 0))
+	{
+		/* Doesn't block: there is nothing left to send or receive. */
+		fleet_host_finish (h, ros_query_wait (c));
+		return;
+	}
+
+	status = fleet_watch (h);
+	if (status != 0)
+		fleet_host_finish (h, status);
+} /* }}} void fleet_host_update */
+
+static void fleet_host_process (ros_fleet_host_t *h, int events) /* {{{ */
+{
+	int status;
+
+	status = ros_connection_process (h->connection, events);
+	if (status != 0)
+	{
+		fleet_host_finish (h, status);
+		return;
+	}
+
+	if (ros_connection_state (h->connection) == ROS_STATE_READY)
+		fleet_deadline_set (h, h->fleet->connect_opts.receive_timeout);
+	else
+		fleet_deadline_set (h, h->fleet->connect_opts.connect_timeout);
+
+	fleet_host_update (h);
+} /* }}} void fleet_host_process */
+
+/* Finishes all hosts whose deadline has passed and returns the time until
+ * the next deadline in milliseconds, or -1 if there is none. */
+static int fleet_expire (ros_fleet_t *f) /* {{{ */
+{
+	ros_fleet_host_t *h;
+	ros_fleet_host_t *next;
+	uint64_t now = clock_now_ms ();
+	uint64_t next_deadline = 0;
+
+	for (h = f->active_head; h != NULL; h = next)
+	{
+		next = h->active_next;
+
+		if (h->deadline == 0)
+			continue;
+
+		if (h->deadline <= now)
+			fleet_host_finish (h, ETIMEDOUT);
+		else if ((next_deadline == 0) || (h->deadline < next_deadline))
+			next_deadline = h->deadline;
+	}
+
+	if (next_deadline == 0)
+		return (-1);
+	else if ((next_deadline - now) > INT32_MAX)
+		return (INT32_MAX);
+	return ((int) (next_deadline - now));
+} /* }}} int fleet_expire */
+
+/* Waits for events on the active hosts for at most "timeout" milliseconds
+ * and processes them. */
+static int fleet_wait (ros_fleet_t *f, int timeout) /* {{{ */
+{
+#if HAVE_SYS_EPOLL_H
+	struct epoll_event events[ROS_FLEET_EVENTS_MAX];
+	int events_num;
+	int i;
+
+	events_num = epoll_wait (f->epoll_fd, events, ROS_FLEET_EVENTS_MAX, timeout);
+	if (events_num < 0)
+		return ((errno == EINTR) ? 0 : errno);
+
+	for (i = 0; i < events_num; i++)
+	{
+		ros_fleet_host_t *h = events[i].data.ptr;
+		int ros_events = 0;
+
+		/* Errors are reported by reading or writing. */
+		if (events[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP))
+			ros_events |= ROS_WANT_READ;
+		if (events[i].events & (EPOLLOUT | EPOLLERR | EPOLLHUP))
+			ros_events |= ROS_WANT_WRITE;
+
+		fleet_host_process (h, ros_events & h->events);
+	}
+
+	return (0);
+#else
+	struct pollfd *pfds;
+	ros_fleet_host_t **hosts;
+	ros_fleet_host_t *h;
+	size_t num;
+	size_t i;
+	int status;
+
+	pfds = calloc (f->active_num, sizeof (*pfds));
+	hosts = calloc (f->active_num, sizeof (*hosts));
+	if ((pfds == NULL) || (hosts == NULL))
+	{
+		free (pfds);
+		free (hosts);
+		return (ENOMEM);
+	}
+
+	num = 0;
+	for (h = f->active_head; h != NULL; h = h->active_next)
+	{
+		pfds[num].fd = h->fd;
+		pfds[num].events = ((h->events & ROS_WANT_READ) ? POLLIN : 0)
+			| ((h->events & ROS_WANT_WRITE) ? POLLOUT : 0);
+		hosts[num] = h;
+		num++;
+	}
+
+	status = 0;
+	if (poll (pfds, (nfds_t) num, timeout) < 0)
+	{
+		if (errno != EINTR)
+			status = errno;
+		num = 0;
+	}
+
+	for (i = 0; i < num; i++)
+	{
+		int ros_events = 0;
+
+		if (pfds[i].revents & (POLLIN | POLLERR | POLLHUP))
+			ros_events |= ROS_WANT_READ;
+		if (pfds[i].revents & (POLLOUT | POLLERR | POLLHUP))
+			ros_events |= ROS_WANT_WRITE;
+
+		if ((ros_events & hosts[i]->events) != 0)
+			fleet_host_process (hosts[i], ros_events & hosts[i]->events);
+	}
+
+	free (pfds);
+	free (hosts);
+	return (status);
+#endif
+} /* }}} int fleet_wait */
+
+/*
+ * Public functions
+ */
+ros_fleet_t *ros_fleet_create (const ros_connect_opts_t *connect_opts, /* {{{ */
+		unsigned int max_connections)
+{
+	ros_fleet_t *f;
+
+	f = malloc (sizeof (*f));
+	if (f == NULL)
+		return (NULL);
+	memset (f, 0, sizeof (*f));
+
+	if (connect_opts != NULL)
+		f->connect_opts = *connect_opts;
+	f->max_connections = max_connections;
+	f->epoll_fd = -1;
+
+	return (f);
+} /* }}} ros_fleet_t *ros_fleet_create */
+
+ros_fleet_host_t *ros_fleet_add_host (ros_fleet_t *f, /* {{{ */
+		const char *node, const char *service,
+		const char *username, const char *password,
+		ros_fleet_done_handler_t done_handler, void *user_data)
+{
+	ros_fleet_host_t *h;
+
+	if ((f == NULL) || (node == NULL) || (username == NULL)
+			|| (password == NULL))
+	{
+		errno = EINVAL;
+		return (NULL);
+	}
+
+	h = malloc (sizeof (*h));
+	if (h == NULL)
+		return (NULL);
+	memset (h, 0, sizeof (*h));
+
+	h->fleet = f;
+	h->node = sstrdup (node);
+	h->service = sstrdup (service);
+	h->username = sstrdup (username);
+	h->password = sstrdup (password);
+	h->done_handler = done_handler;
+	h->user_data = user_data;
+	h->fd = -1;
+
+	if ((h->node == NULL) || ((service != NULL) && (h->service == NULL))
+			|| (h->username == NULL) || (h->password == NULL))
+	{
+		free (h->node);
+		free (h->service);
+		fleet_strfree (h->username);
+		fleet_strfree (h->password);
+		free (h);
+		errno = ENOMEM;
+		return (NULL);
+	}
+
+	if (f->hosts_tail == NULL)
+		f->hosts_head = h;
+	else
+		f->hosts_tail->next = h;
+	f->hosts_tail = h;
+
+	return (h);
+} /* }}} ros_fleet_host_t *ros_fleet_add_host */
+
+int ros_fleet_add_query (ros_fleet_host_t *h, /* {{{ */
+		const char *command,
+		size_t args_num, const char * const *args,
+		ros_reply_handler_t handler, void *user_data)
+{
+	fleet_query_t *q;
+	size_t i;
+
+	if ((h == NULL) || (command == NULL) || (handler == NULL)
+			|| ((args_num > 0) && (args == NULL)))
+		return (EINVAL);
+
+	q = malloc (sizeof (*q));
+	if (q == NULL)
+		return (ENOMEM);
+	memset (q, 0, sizeof (*q));
+
+	q->command = sstrdup (command);
+	if (q->command == NULL)
+	{
+		fleet_query_free (q);
+		return (ENOMEM);
+	}
+
+	if (args_num > 0)
+	{
+		q->args = calloc (args_num, sizeof (*q->args));
+		if (q->args == NULL)
+		{
+			fleet_query_free (q);
+			return (ENOMEM);
+		}
+	}
+
+	for (i = 0; i < args_num; i++)
+	{
+		q->args[i] = sstrdup (args[i]);
+		if (q->args[i] == NULL)
+		{
+			fleet_query_free (q);
+			return (ENOMEM);
+		}
+		q->args_num++;
+	}
+
+	q->handler = handler;
+	q->user_data = user_data;
+
+	if (h->queries_tail == NULL)
+		h->queries_head = q;
+	else
+		h->queries_tail->next = q;
+	h->queries_tail = q;
+
+	return (0);
+} /* }}} int ros_fleet_add_query */
+
+int ros_fleet_run (ros_fleet_t *f) /* {{{ */
+{
+	ros_fleet_host_t *next_host;
+	int status;
+
+	if (f == NULL)
+		return (EINVAL);
+	if (f->epoll_fd >= 0)
+		return (EBUSY);
+
+#if HAVE_SYS_EPOLL_H
+	f->epoll_fd = epoll_create (ROS_FLEET_EVENTS_MAX);
+	if (f->epoll_fd < 0)
+		return (errno);
+#else
+	/* Marks the fleet as running. */
+	f->epoll_fd = 0;
+#endif
+
+	status = 0;
+	next_host = f->hosts_head;
+	while ((next_host != NULL) || (f->active_head != NULL))
+	{
+		int timeout;
+
+		while ((next_host != NULL)
+				&& ((f->max_connections == 0)
+					|| (f->active_num < f->max_connections)))
+		{
+			fleet_host_start (next_host);
+			next_host = next_host->next;
+		}
+
+		timeout = fleet_expire (f);
+		if (f->active_head == NULL)
+			continue;
+
+		status = fleet_wait (f, timeout);
+		if (status != 0)
+			break;
+	}
+
+	/* Only reached with active hosts if waiting failed. */
+	while (f->active_head != NULL)
+		fleet_host_finish (f->active_head, status);
+
+#if HAVE_SYS_EPOLL_H
+	close (f->epoll_fd);
+#endif
+	f->epoll_fd = -1;
+
+	return (status);
+} /* }}} int ros_fleet_run */
+
+int ros_fleet_destroy (ros_fleet_t *f) /* {{{ */
+{
+	ros_fleet_host_t *h;
+
+	if (f == NULL)
+		return (EINVAL);
+
+	h = f->hosts_head;
+	while (h != NULL)
+	{
+		ros_fleet_host_t *next = h->next;
+		fleet_query_t *q;
+
+		q = h->queries_head;
+		while (q != NULL)
+		{
+			fleet_query_t *q_next = q->next;
+			fleet_query_free (q);
+			q = q_next;
+		}
+
+		free (h->node);
+		free (h->service);
+		fleet_strfree (h->username);
+		fleet_strfree (h->password);
+		free (h);
+
+		h = next;
+	}
+
+	free (f);
+	return (0);
+} /* }}} int ros_fleet_destroy */
+
+/* vim: set ts=2 sw=2 noet fdm=marker : */
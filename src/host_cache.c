@@ -0,0 +1,575 @@
+/**
+ * librouteros - src/host_cache.c
+ * Copyright (C) 2026  agent
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+ * OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ *
+ * Authors:
+ *   agent <agent at local>
+ **/
+
+#ifndef _ISOC99_SOURCE
+# define _ISOC99_SOURCE
+#endif
+
+#ifndef _POSIX_C_SOURCE
+# define _POSIX_C_SOURCE 200112L
+#endif
+
+#include "config.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netdb.h>
+
+#include "routeros_api.h"
+#include "host_cache.h"
+#include "ros_util.h"
+
+#define HOST_TABLE_SIZE_MIN 16
+#define HOST_ADDRESSES_MAX 16
+
+/*
+ * Private data types
+ */
+struct host_address_s
+{
+	struct sockaddr_storage addr;
+	socklen_t addr_len;
+};
+typedef struct host_address_s host_address_t;
+
+struct host_entry_s;
+typedef struct host_entry_s host_entry_t;
+struct host_entry_s
+{
+	char *node;
+	char *service;
+	uint32_t hash;
+
+	int auth;
+	/* AF_INET, AF_INET6 or AF_UNSPEC */
+	int family;
+
+	/* Resolved addresses, in the order returned by getaddrinfo(), and the
+	 * time they expire, in seconds of the monotonic clock. */
+	host_address_t *addresses;
+	size_t addresses_num;
+	uint64_t addresses_expire;
+
+	host_entry_t *next;
+};
+
+struct ros_host_cache_s
+{
+	pthread_mutex_t lock;
+	/* Seconds resolved addresses are used for; zero disables caching them. */
+	unsigned int address_ttl;
+
+	host_entry_t **table;
+	size_t table_size;
+	size_t entries_num;
+};
+
+static const char *const host_auth_names[] =
+{
+	NULL,        /* HOST_AUTH_UNKNOWN */
+	"plain",     /* HOST_AUTH_PLAIN */
+	"challenge"  /* HOST_AUTH_CHALLENGE */
+};
+#define HOST_AUTH_NAMES_NUM (sizeof (host_auth_names) / sizeof (host_auth_names[0]))
+
+/*
+ * Private functions
+ */
+/* FNV-1a over node, a null byte and service. */
+static uint32_t host_hash (const char *node, const char *service) /* {{{ */
+{
+	uint32_t hash;
+
+	hash = fnv1a (FNV1A_INIT, node);
+	hash *= FNV1A_PRIME;
+	return (fnv1a (hash, service));
+} /* }}} uint32_t host_hash */
+
+static const char *host_family_name (int family) /* {{{ */
+{
+	if (family == AF_INET)
+		return ("inet");
+	else if (family == AF_INET6)
+		return ("inet6");
+	return (NULL);
+} /* }}} const char *host_family_name */
+
+static void host_entry_free (host_entry_t *e) /* {{{ */
+{
+	if (e == NULL)
+		return;
+
+	free (e->node);
+	free (e->service);
+	free (e->addresses);
+	free (e);
+} /* }}} void host_entry_free */
+
+static int host_table_grow (ros_host_cache_t *hc) /* {{{ */
+{
+	host_entry_t **table;
+	size_t size;
+	size_t i;
+
+	size = 2 * hc->table_size;
+	if (size < HOST_TABLE_SIZE_MIN)
+		size = HOST_TABLE_SIZE_MIN;
+
+	table = calloc (size, sizeof (*table));
+	if (table == NULL)
+		return (ENOMEM);
+
+	for (i = 0; i < hc->table_size; i++)
+	{
+		host_entry_t *e;
+		host_entry_t *next;
+
+		for (e = hc->table[i]; e != NULL; e = next)
+		{
+			next = e->next;
+			e->next = table[e->hash & (size - 1)];
+			table[e->hash & (size - 1)] = e;
+		}
+	}
+
+	free (hc->table);
+	hc->table = table;
+	hc->table_size = size;
+
+	return (0);
+} /* }}} int host_table_grow */
+
+/* Returns the entry of "node" and "service". If there is none and "create" is
+ * true, a new entry is added. Must be called with the lock held. */
+static host_entry_t *host_entry_get (ros_host_cache_t *hc, /* {{{ */
+		const char *node, const char *service, _Bool create)
+{
+	host_entry_t *e;
+	uint32_t hash;
+
+	hash = host_hash (node, service);
+
+	if (hc->table_size > 0)
+	{
+		for (e = hc->table[hash & (hc->table_size - 1)]; e != NULL; e = e->next)
+			if ((e->hash == hash) && (strcmp (e->node, node) == 0)
+					&& (strcmp (e->service, service) == 0))
+				return (e);
+	}
+
+	if (!create)
+		return (NULL);
+
+	if (hc->entries_num >= hc->table_size)
+		if (host_table_grow (hc) != 0)
+			return (NULL);
+
+	e = calloc (1, sizeof (*e));
+	if (e == NULL)
+		return (NULL);
+
+	e->node = sstrdup (node);
+	e->service = sstrdup (service);
+	if ((e->node == NULL) || (e->service == NULL))
+	{
+		host_entry_free (e);
+		return (NULL);
+	}
+	e->hash = hash;
+	e->family = AF_UNSPEC;
+
+	e->next = hc->table[hash & (hc->table_size - 1)];
+	hc->table[hash & (hc->table_size - 1)] = e;
+	hc->entries_num++;
+
+	return (e);
+} /* }}} host_entry_t *host_entry_get */
+
+/* Parses one line of a cache file: the node, the service and any number of
+ * "key=value" pairs, separated by white space. Unknown keys are ignored.
+ * Must be called with the lock held. */
+static void host_line_parse (ros_host_cache_t *hc, char *line) /* {{{ */
+{
+	char *saveptr = NULL;
+	char *node;
+	char *service;
+	char *field;
+	host_entry_t *e;
+
+	node = strtok_r (line, " \t\r\n", &saveptr);
+	if ((node == NULL) || (node[0] == '#'))
+		return;
+	service = strtok_r (NULL, " \t\r\n", &saveptr);
+	if (service == NULL)
+		return;
+
+	e = host_entry_get (hc, node, service, /* create = */ 1);
+	if (e == NULL)
+		return;
+
+	while ((field = strtok_r (NULL, " \t\r\n", &saveptr)) != NULL)
+	{
+		char *value = strchr (field, '=');
+		size_t i;
+
+		if (value == NULL)
+			continue;
+		*value = 0;
+		value++;
+
+		if (strcmp (field, "auth") == 0)
+		{
+			for (i = 1; i < HOST_AUTH_NAMES_NUM; i++)
+				if (strcmp (value, host_auth_names[i]) == 0)
+					e->auth = (int) i;
+		}
+		else if (strcmp (field, "family") == 0)
+		{
+			if (strcmp (value, "inet") == 0)
+				e->family = AF_INET;
+			else if (strcmp (value, "inet6") == 0)
+				e->family = AF_INET6;
+		}
+	}
+} /* }}} void host_line_parse */
+
+/*
+ * Semi-private functions
+ */
+int host_cache_auth_get (ros_host_cache_t *hc, /* {{{ */
+		const char *node, const char *service)
+{
+	host_entry_t *e;
+	int auth;
+
+	if ((hc == NULL) || (node == NULL) || (service == NULL))
+		return (HOST_AUTH_UNKNOWN);
+
+	pthread_mutex_lock (&hc->lock);
+	e = host_entry_get (hc, node, service, /* create = */ 0);
+	auth = (e != NULL) ? e->auth : HOST_AUTH_UNKNOWN;
+	pthread_mutex_unlock (&hc->lock);
+
+	return (auth);
+} /* }}} int host_cache_auth_get */
+
+void host_cache_auth_set (ros_host_cache_t *hc, /* {{{ */
+		const char *node, const char *service, int auth)
+{
+	host_entry_t *e;
+
+	if ((hc == NULL) || (node == NULL) || (service == NULL))
+		return;
+
+	pthread_mutex_lock (&hc->lock);
+	e = host_entry_get (hc, node, service, /* create = */ 1);
+	if (e != NULL)
+		e->auth = auth;
+	pthread_mutex_unlock (&hc->lock);
+} /* }}} void host_cache_auth_set */
+
+int host_cache_family_get (ros_host_cache_t *hc, /* {{{ */
+		const char *node, const char *service)
+{
+	host_entry_t *e;
+	int family;
+
+	if ((hc == NULL) || (node == NULL) || (service == NULL))
+		return (AF_UNSPEC);
+
+	pthread_mutex_lock (&hc->lock);
+	e = host_entry_get (hc, node, service, /* create = */ 0);
+	family = (e != NULL) ? e->family : AF_UNSPEC;
+	pthread_mutex_unlock (&hc->lock);
+
+	return (family);
+} /* }}} int host_cache_family_get */
+
+void host_cache_family_set (ros_host_cache_t *hc, /* {{{ */
+		const char *node, const char *service, int family)
+{
+	host_entry_t *e;
+
+	if ((hc == NULL) || (node == NULL) || (service == NULL))
+		return;
+
+	pthread_mutex_lock (&hc->lock);
+	e = host_entry_get (hc, node, service, /* create = */ 1);
+	if (e != NULL)
+		e->family = family;
+	pthread_mutex_unlock (&hc->lock);
+} /* }}} void host_cache_family_set */
+
+struct addrinfo *host_cache_addresses_get (ros_host_cache_t *hc, /* {{{ */
+		const char *node, const char *service)
+{
+	host_entry_t *e;
+	struct addrinfo *ai;
+	struct sockaddr_storage *addr;
+	size_t i;
+
+	if ((hc == NULL) || (node == NULL) || (service == NULL))
+		return (NULL);
+
+	ai = NULL;
+	pthread_mutex_lock (&hc->lock);
+	e = host_entry_get (hc, node, service, /* create = */ 0);
+	if ((e != NULL) && (e->addresses_num > 0)
+			&& (clock_now_s () < e->addresses_expire))
+	{
+		/* One allocation for the list and the addresses, so that it can be freed
+		 * with free(3). */
+		ai = calloc (e->addresses_num, sizeof (*ai) + sizeof (*addr));
+		if (ai != NULL)
+		{
+			addr = (struct sockaddr_storage *) (ai + e->addresses_num);
+			for (i = 0; i < e->addresses_num; i++)
+			{
+				memcpy (addr + i, &e->addresses[i].addr, e->addresses[i].addr_len);
+				ai[i].ai_family = addr[i].ss_family;
+				ai[i].ai_socktype = SOCK_STREAM;
+				ai[i].ai_addr = (struct sockaddr *) (addr + i);
+				ai[i].ai_addrlen = e->addresses[i].addr_len;
+				ai[i].ai_next = ((i + 1) < e->addresses_num) ? ai + i + 1 : NULL;
+			}
+		}
+	}
+	pthread_mutex_unlock (&hc->lock);
+
+	return (ai);
+} /* }}} struct addrinfo *host_cache_addresses_get */
+
+void host_cache_addresses_set (ros_host_cache_t *hc, /* {{{ */
+		const char *node, const char *service, const struct addrinfo *ai_list)
+{
+	host_entry_t *e;
+	host_address_t *addresses;
+	const struct addrinfo *ai_ptr;
+	size_t num;
+
+	if ((hc == NULL) || (node == NULL) || (service == NULL)
+			|| (hc->address_ttl == 0))
+		return;
+
+	addresses = calloc (HOST_ADDRESSES_MAX, sizeof (*addresses));
+	if (addresses == NULL)
+		return;
+
+	num = 0;
+	for (ai_ptr = ai_list; ai_ptr != NULL; ai_ptr = ai_ptr->ai_next)
+	{
+		if ((ai_ptr->ai_socktype != SOCK_STREAM)
+				|| (ai_ptr->ai_addrlen > sizeof (addresses[num].addr)))
+			continue;
+
+		memcpy (&addresses[num].addr, ai_ptr->ai_addr, ai_ptr->ai_addrlen);
+		addresses[num].addr_len = ai_ptr->ai_addrlen;
+		num++;
+		if (num >= HOST_ADDRESSES_MAX)
+			break;
+	}
+
+	pthread_mutex_lock (&hc->lock);
+	e = host_entry_get (hc, node, service, /* create = */ 1);
+	if (e != NULL)
+	{
+		free (e->addresses);
+		e->addresses = addresses;
+		e->addresses_num = num;
+		e->addresses_expire = clock_now_s () + hc->address_ttl;
+		addresses = NULL;
+	}
+	pthread_mutex_unlock (&hc->lock);
+
+	free (addresses);
+} /* }}} void host_cache_addresses_set */
+
+void host_cache_addresses_forget (ros_host_cache_t *hc, /* {{{ */
+		const char *node, const char *service)
+{
+	host_entry_t *e;
+
+	if ((hc == NULL) || (node == NULL) || (service == NULL))
+		return;
+
+	pthread_mutex_lock (&hc->lock);
+	e = host_entry_get (hc, node, service, /* create = */ 0);
+	if (e != NULL)
+	{
+		free (e->addresses);
+		e->addresses = NULL;
+		e->addresses_num = 0;
+	}
+	pthread_mutex_unlock (&hc->lock);
+} /* }}} void host_cache_addresses_forget */
+
+/*
+ * Public functions
+ */
+ros_host_cache_t *ros_host_cache_create (unsigned int address_ttl) /* {{{ */
+{
+	ros_host_cache_t *hc;
+
+	hc = malloc (sizeof (*hc));
+	if (hc == NULL)
+		return (NULL);
+	memset (hc, 0, sizeof (*hc));
+	hc->address_ttl = address_ttl;
+
+	if (pthread_mutex_init (&hc->lock, /* attr = */ NULL) != 0)
+	{
+		free (hc);
+		return (NULL);
+	}
+
+	return (hc);
+} /* }}} ros_host_cache_t *ros_host_cache_create */
+
+void ros_host_cache_destroy (ros_host_cache_t *hc) /* {{{ */
+{
+	size_t i;
+
+	if (hc == NULL)
+		return;
+
+	for (i = 0; i < hc->table_size; i++)
+	{
+		host_entry_t *e;
+		host_entry_t *next;
+
+		for (e = hc->table[i]; e != NULL; e = next)
+		{
+			next = e->next;
+			host_entry_free (e);
+		}
+	}
+
+	pthread_mutex_destroy (&hc->lock);
+	free (hc->table);
+	free (hc);
+} /* }}} void ros_host_cache_destroy */
+
+int ros_host_cache_load (ros_host_cache_t *hc, const char *file) /* {{{ */
+{
+	FILE *fh;
+	char line[1024];
+
+	if ((hc == NULL) || (file == NULL))
+		return (EINVAL);
+
+	fh = fopen (file, "r");
+	if (fh == NULL)
+		return (errno);
+
+	pthread_mutex_lock (&hc->lock);
+	while (fgets (line, sizeof (line), fh) != NULL)
+	{
+		size_t len = strlen (line);
+
+		/* Skip overlong lines. */
+		if ((len > 0) && (line[len - 1] != '\n') && !feof (fh))
+		{
+			int ch;
+
+			do
+				ch = fgetc (fh);
+			while ((ch != EOF) && (ch != '\n'));
+			continue;
+		}
+
+		host_line_parse (hc, line);
+	}
+	pthread_mutex_unlock (&hc->lock);
+
+	fclose (fh);
+	return (0);
+} /* }}} int ros_host_cache_load */
+
+int ros_host_cache_save (ros_host_cache_t *hc, const char *file) /* {{{ */
+{
+	FILE *fh;
+	char *tmp_file;
+	size_t i;
+	int status;
+
+	if ((hc == NULL) || (file == NULL))
+		return (EINVAL);
+
+	/* Write to a temporary file first, so that readers never see a partial
+	 * file. */
+	tmp_file = malloc (strlen (file) + sizeof (".tmp"));
+	if (tmp_file == NULL)
+		return (ENOMEM);
+	sprintf (tmp_file, "%s.tmp", file);
+
+	fh = fopen (tmp_file, "w");
+	if (fh == NULL)
+	{
+		status = errno;
+		free (tmp_file);
+		return (status);
+	}
+
+	pthread_mutex_lock (&hc->lock);
+	for (i = 0; i < hc->table_size; i++)
+	{
+		host_entry_t *e;
+
+		for (e = hc->table[i]; e != NULL; e = e->next)
+		{
+			const char *family = host_family_name (e->family);
+			_Bool have_auth = (e->auth > HOST_AUTH_UNKNOWN)
+				&& (e->auth < (int) HOST_AUTH_NAMES_NUM);
+
+			if (!have_auth && (family == NULL))
+				continue;
+
+			fprintf (fh, "%s %s", e->node, e->service);
+			if (have_auth)
+				fprintf (fh, " auth=%s", host_auth_names[e->auth]);
+			if (family != NULL)
+				fprintf (fh, " family=%s", family);
+			fprintf (fh, "\n");
+		}
+	}
+	pthread_mutex_unlock (&hc->lock);
+
+	status = 0;
+	if (ferror (fh))
+		status = EIO;
+	if ((fclose (fh) != 0) && (status == 0))
+		status = errno;
+	if ((status == 0) && (rename (tmp_file, file) != 0))
+		status = errno;
+
+	if (status != 0)
+		remove (tmp_file);
+	free (tmp_file);
+	return (status);
+} /* }}} int ros_host_cache_save */
+
+/* vim: set ts=2 sw=2 noet fdm=marker : */
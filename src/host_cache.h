@@ -0,0 +1,59 @@
+/**
+ * librouteros - src/host_cache.h
+ * Copyright (C) 2026  agent
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+ * OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ *
+ * Authors:
+ *   agent <agent at local>
+ **/
+
+#ifndef HOST_CACHE_H
+#define HOST_CACHE_H 1
+
+/* Login methods */
+#define HOST_AUTH_UNKNOWN   0
+#define HOST_AUTH_PLAIN     1 /* post-v6.43: name and password */
+#define HOST_AUTH_CHALLENGE 2 /* pre-v6.43: MD5 challenge and response */
+
+/* Returns the login method last used with "node" and "service", or
+ * HOST_AUTH_UNKNOWN. "hc" may be NULL. */
+int host_cache_auth_get (ros_host_cache_t *hc,
+		const char *node, const char *service);
+/* Records the login method used with "node" and "service". Errors are
+ * ignored: the cache is an optimization only. */
+void host_cache_auth_set (ros_host_cache_t *hc,
+		const char *node, const char *service, int auth);
+
+/* Returns the address family of the last successful connection to "node" and
+ * "service", or AF_UNSPEC. */
+int host_cache_family_get (ros_host_cache_t *hc,
+		const char *node, const char *service);
+void host_cache_family_set (ros_host_cache_t *hc,
+		const char *node, const char *service, int family);
+
+/* Returns a copy of the addresses "node" and "service" resolved to, or NULL if
+ * there are none or they have expired. The list must be freed using free(3),
+ * not freeaddrinfo(3). */
+struct addrinfo *host_cache_addresses_get (ros_host_cache_t *hc,
+		const char *node, const char *service);
+/* Stores the stream socket addresses of "ai_list" for the cache's TTL. */
+void host_cache_addresses_set (ros_host_cache_t *hc,
+		const char *node, const char *service, const struct addrinfo *ai_list);
+/* Removes the addresses, e.g. after connecting to all of them failed. */
+void host_cache_addresses_forget (ros_host_cache_t *hc,
+		const char *node, const char *service);
+
+#endif /* HOST_CACHE_H */
+
+/* vim: set ts=2 sw=2 noet fdm=marker : */
@@ -29,6 +29,7 @@
 #include "config.h"
 
 #include <stdlib.h>
+#include <stddef.h>
 #include <stdbool.h>
 #include <math.h>
 #include <errno.h>
@@ -51,100 +52,182 @@ struct rt_internal_data_s
 };
 typedef struct rt_internal_data_s rt_internal_data_t;
 
+struct rt_array_internal_data_s
+{
+	ros_interface_array_handler_t handler;
+	void *user_data;
+};
+typedef struct rt_array_internal_data_s rt_array_internal_data_t;
+
+/* Sorted by key. Older versions report combined "rx/tx" counters, newer
+ * versions separate parameters. As before the table was introduced, the
+ * presence of "packets" decides which format is used; the other one is
+ * ignored, whatever order the parameters arrive in. */
+static const schema_field_t if_fields[] =
+{
+	SCHEMA_FIELD_RX_TX_WITH ("bytes", ros_interface_t, rx_bytes, tx_bytes,
+			ROS_INTERFACE_FIELD_RX_BYTES
+			| ROS_INTERFACE_FIELD_TX_BYTES,
+			"packets"),
+	SCHEMA_FIELD ("comment", SCHEMA_STRING, ros_interface_t, comment,
+			ROS_INTERFACE_FIELD_COMMENT),
+	SCHEMA_FIELD ("disabled", SCHEMA_BOOL_NOT, ros_interface_t, enabled,
+			ROS_INTERFACE_FIELD_ENABLED),
+	SCHEMA_FIELD_RX_TX_WITH ("drops", ros_interface_t, rx_drops, tx_drops,
+			ROS_INTERFACE_FIELD_RX_DROPS
+			| ROS_INTERFACE_FIELD_TX_DROPS,
+			"packets"),
+	SCHEMA_FIELD ("dynamic", SCHEMA_BOOL, ros_interface_t, dynamic,
+			ROS_INTERFACE_FIELD_DYNAMIC),
+	SCHEMA_FIELD_RX_TX_WITH ("errors", ros_interface_t, rx_errors, tx_errors,
+			ROS_INTERFACE_FIELD_RX_ERRORS
+			| ROS_INTERFACE_FIELD_TX_ERRORS,
+			"packets"),
+	SCHEMA_FIELD ("l2mtu", SCHEMA_UINT, ros_interface_t, l2mtu,
+			ROS_INTERFACE_FIELD_L2MTU),
+	SCHEMA_FIELD ("mtu", SCHEMA_UINT, ros_interface_t, mtu,
+			ROS_INTERFACE_FIELD_MTU),
+	SCHEMA_FIELD ("name", SCHEMA_STRING, ros_interface_t, name,
+			ROS_INTERFACE_FIELD_NAME),
+	SCHEMA_FIELD_RX_TX ("packets", ros_interface_t, rx_packets, tx_packets,
+			ROS_INTERFACE_FIELD_RX_PACKETS
+			| ROS_INTERFACE_FIELD_TX_PACKETS),
+	SCHEMA_FIELD ("running", SCHEMA_BOOL, ros_interface_t, running,
+			ROS_INTERFACE_FIELD_RUNNING),
+	SCHEMA_FIELD_WITHOUT ("rx-byte", SCHEMA_UINT64, ros_interface_t, rx_bytes,
+			ROS_INTERFACE_FIELD_RX_BYTES, "packets"),
+	SCHEMA_FIELD_WITHOUT ("rx-drop", SCHEMA_UINT64, ros_interface_t, rx_drops,
+			ROS_INTERFACE_FIELD_RX_DROPS, "packets"),
+	SCHEMA_FIELD_WITHOUT ("rx-error", SCHEMA_UINT64, ros_interface_t, rx_errors,
+			ROS_INTERFACE_FIELD_RX_ERRORS, "packets"),
+	SCHEMA_FIELD_WITHOUT ("rx-packet", SCHEMA_UINT64, ros_interface_t, rx_packets,
+			ROS_INTERFACE_FIELD_RX_PACKETS, "packets"),
+	SCHEMA_FIELD_WITHOUT ("tx-byte", SCHEMA_UINT64, ros_interface_t, tx_bytes,
+			ROS_INTERFACE_FIELD_TX_BYTES, "packets"),
+	SCHEMA_FIELD_WITHOUT ("tx-drop", SCHEMA_UINT64, ros_interface_t, tx_drops,
+			ROS_INTERFACE_FIELD_TX_DROPS, "packets"),
+	SCHEMA_FIELD_WITHOUT ("tx-error", SCHEMA_UINT64, ros_interface_t, tx_errors,
+			ROS_INTERFACE_FIELD_TX_ERRORS, "packets"),
+	SCHEMA_FIELD_WITHOUT ("tx-packet", SCHEMA_UINT64, ros_interface_t, tx_packets,
+			ROS_INTERFACE_FIELD_TX_PACKETS, "packets"),
+	SCHEMA_FIELD ("type", SCHEMA_STRING, ros_interface_t, type,
+			ROS_INTERFACE_FIELD_TYPE)
+};
+
 /*
  * Private functions
  */
-static ros_interface_t *rt_reply_to_interface (const ros_reply_t *r) /* {{{ */
+/* Decodes all "re" sentences of a reply into one array. The "next" pointers
+ * link the array elements, so the result can be passed to list-based
+ * callbacks, too. The array is NULL if the reply has no entries. */
+static int rt_reply_to_interface (const ros_reply_t *r, /* {{{ */
+		ros_interface_t **ret_array, size_t *ret_num)
 {
-	ros_interface_t *ret;
+	const ros_reply_t *ptr;
+	ros_interface_t *array;
+	size_t num;
+	size_t i;
 
-	if (r == NULL)
-		return (NULL);
+	*ret_array = NULL;
+	*ret_num = 0;
 
-	if (strcmp ("re", ros_reply_status (r)) != 0)
-		return (rt_reply_to_interface (ros_reply_next (r)));
+	num = 0;
+	for (ptr = r; ptr != NULL; ptr = ros_reply_next (ptr))
+		if (strcmp ("re", ros_reply_status (ptr)) == 0)
+			num++;
 
-	ret = malloc (sizeof (*ret));
-	if (ret == NULL)
-		return (NULL);
-	memset (ret, 0, sizeof (*ret));
+	if (num == 0)
+		return (0);
 
-	ret->name = ros_reply_param_val_by_key (r, "name");
-	ret->type = ros_reply_param_val_by_key (r, "type");
-	ret->comment = ros_reply_param_val_by_key (r, "comment");
+	array = calloc (num, sizeof (*array));
+	if (array == NULL)
+		return (ENOMEM);
 
-	if (ros_reply_param_val_by_key (r, "packets") == NULL)
-	{
-		ret->rx_packets = sstrtoui64 (ros_reply_param_val_by_key (r, "rx-packet"));
-		ret->tx_packets = sstrtoui64 (ros_reply_param_val_by_key (r, "tx-packet"));
-		ret->rx_bytes = sstrtoui64 (ros_reply_param_val_by_key (r, "rx-byte"));
-		ret->tx_bytes = sstrtoui64 (ros_reply_param_val_by_key (r, "tx-byte"));
-		ret->rx_errors = sstrtoui64 (ros_reply_param_val_by_key (r, "rx-error"));
-		ret->tx_errors = sstrtoui64 (ros_reply_param_val_by_key (r, "tx-error"));
-		ret->rx_drops = sstrtoui64 (ros_reply_param_val_by_key (r, "rx-drop"));
-		ret->tx_drops = sstrtoui64 (ros_reply_param_val_by_key (r, "tx-drop"));
-	}
-	else
+	i = 0;
+	for (ptr = r; ptr != NULL; ptr = ros_reply_next (ptr))
 	{
-		sstrto_rx_tx_counters (ros_reply_param_val_by_key (r, "packets"),
-				&ret->rx_packets, &ret->tx_packets);
-		sstrto_rx_tx_counters (ros_reply_param_val_by_key (r, "bytes"),
-				&ret->rx_bytes, &ret->tx_bytes);
-		sstrto_rx_tx_counters (ros_reply_param_val_by_key (r, "errors"),
-				&ret->rx_errors, &ret->tx_errors);
-		sstrto_rx_tx_counters (ros_reply_param_val_by_key (r, "drops"),
-				&ret->rx_drops, &ret->tx_drops);
+		if (strcmp ("re", ros_reply_status (ptr)) != 0)
+			continue;
+
+		schema_decode (ptr, if_fields, sizeof (if_fields) / sizeof (if_fields[0]),
+				array + i);
+		if (i > 0)
+			array[i - 1].next = array + i;
+		i++;
 	}
 
-	ret->mtu = sstrtoui (ros_reply_param_val_by_key (r, "mtu"));
-	ret->l2mtu = sstrtoui (ros_reply_param_val_by_key (r, "l2mtu"));
+	*ret_array = array;
+	*ret_num = num;
+	return (0);
+} /* }}} int rt_reply_to_interface */
 
-	ret->dynamic = sstrtob (ros_reply_param_val_by_key (r, "dynamic"));
-	ret->running = sstrtob (ros_reply_param_val_by_key (r, "running"));
-	ret->enabled = !sstrtob (ros_reply_param_val_by_key (r, "disabled"));
+static int if_internal_handler (ros_connection_t *c, /* {{{ */
+		const ros_reply_t *r, void *user_data)
+{
+	ros_interface_t *if_data;
+	size_t if_num;
+	rt_internal_data_t *internal_data;
+	int status;
 
-	ret->next = rt_reply_to_interface (ros_reply_next (r));
+	status = rt_reply_to_interface (r, &if_data, &if_num);
+	if (status != 0)
+		return (status);
 
-	return (ret);
-} /* }}} ros_interface_t *rt_reply_to_interface */
+	/* As before, the list handler is not called for an empty list. */
+	if (if_num == 0)
+		return (0);
 
-static void if_interface_free (const ros_interface_t *r) /* {{{ */
-{
-	const ros_interface_t *next;
+	internal_data = user_data;
 
-	while (r != NULL)
-	{
-		next = r->next;
-		free ((void *) r);
-		r = next;
-	}
-} /* }}} void if_interface_free */
+	status = internal_data->handler (c, if_data, internal_data->user_data);
 
-static int if_internal_handler (ros_connection_t *c, /* {{{ */
+	free (if_data);
+
+	return (status);
+} /* }}} int if_internal_handler */
+
+static int if_array_internal_handler (ros_connection_t *c, /* {{{ */
 		const ros_reply_t *r, void *user_data)
 {
 	ros_interface_t *if_data;
-	rt_internal_data_t *internal_data;
+	size_t if_num;
+	rt_array_internal_data_t *internal_data;
 	int status;
 
-	if_data = rt_reply_to_interface (r);
-	if (if_data == NULL)
-		return (errno);
+	status = rt_reply_to_interface (r, &if_data, &if_num);
+	if (status != 0)
+		return (status);
 
 	internal_data = user_data;
 
-	status = internal_data->handler (c, if_data, internal_data->user_data);
+	status = internal_data->handler (c, if_data, if_num,
+			internal_data->user_data);
 
-	if_interface_free (if_data);
+	free (if_data);
 
 	return (status);
-} /* }}} int if_internal_handler */
+} /* }}} int if_array_internal_handler */
+
+/* Used by test_parse to check the table. */
+const schema_field_t *if_schema (size_t *ret_num) /* {{{ */
+{
+	*ret_num = sizeof (if_fields) / sizeof (if_fields[0]);
+	return (if_fields);
+} /* }}} const schema_field_t *if_schema */
 
 /*
  * Public functions
  */
 int ros_interface (ros_connection_t *c, /* {{{ */
 		ros_interface_handler_t handler, void *user_data)
+{
+	return (ros_interface_with_options (c, handler, user_data,
+				/* opts = */ NULL));
+} /* }}} int ros_interface */
+
+int ros_interface_with_options (ros_connection_t *c, /* {{{ */
+		ros_interface_handler_t handler, void *user_data,
+		const ros_query_options_t *opts)
 {
 	rt_internal_data_t data;
 
@@ -154,9 +237,33 @@ int ros_interface (ros_connection_t *c, /* {{{ */
 	data.handler = handler;
 	data.user_data = user_data;
 
-	return (ros_query (c, "/interface/print",
-				/* args_num = */ 0, /* args = */ NULL,
+	return (schema_query (c, "/interface/print",
+				if_fields, sizeof (if_fields) / sizeof (if_fields[0]), opts,
 				if_internal_handler, &data));
-} /* }}} int ros_interface */
+} /* }}} int ros_interface_with_options */
+
+int ros_interface_array (ros_connection_t *c, /* {{{ */
+		ros_interface_array_handler_t handler, void *user_data)
+{
+	return (ros_interface_array_with_options (c, handler, user_data,
+				/* opts = */ NULL));
+} /* }}} int ros_interface_array */
+
+int ros_interface_array_with_options (ros_connection_t *c, /* {{{ */
+		ros_interface_array_handler_t handler, void *user_data,
+		const ros_query_options_t *opts)
+{
+	rt_array_internal_data_t data;
+
+	if ((c == NULL) || (handler == NULL))
+		return (EINVAL);
+
+	data.handler = handler;
+	data.user_data = user_data;
+
+	return (schema_query (c, "/interface/print",
+				if_fields, sizeof (if_fields) / sizeof (if_fields[0]), opts,
+				if_array_internal_handler, &data));
+} /* }}} int ros_interface_array_with_options */
 
 /* vim: set ts=2 sw=2 noet fdm=marker : */
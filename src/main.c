@@ -36,16 +36,21 @@
 #include <string.h>
 #include <errno.h>
 #include <assert.h>
+#include <limits.h>
 
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <netdb.h>
 #include <sys/time.h>
+#include <time.h>
 #include <fcntl.h>
+#include <poll.h>
 
 #include "md5/md5.h"
 
 #include "routeros_api.h"
+#include "host_cache.h"
+#include "ros_util.h"
 
 #if WITH_DEBUG
 # define ros_debug(...) fprintf (stdout, __VA_ARGS__)
@@ -59,16 +64,241 @@
 
 /* needed prototypes */
 static int login_handler (ros_connection_t *c, const ros_reply_t *r, void *user_data);
-
-/* FIXME */
-char *strdup (const char *);
+int ros_disconnect (ros_connection_t *c);
+
+/* Initial size of the per-connection receive buffer. The buffer is grown when
+ * a single sentence does not fit. */
+#define ROS_RECV_BUFFER_SIZE 16384
+/* Size of the first block of a reply arena. Subsequent blocks double in size
+ * up to ROS_ARENA_BLOCK_SIZE_MAX. */
+#define ROS_ARENA_BLOCK_SIZE 4096
+#define ROS_ARENA_BLOCK_SIZE_MAX 262144
+/* Initial size of the per-connection send buffer. The buffer is grown as
+ * necessary. */
+#define ROS_SEND_BUFFER_SIZE 4096
+
+/* Connecting tries up to ROS_CONNECT_ATTEMPTS_MAX addresses and starts the
+ * next attempt ROS_CONNECT_ATTEMPT_DELAY milliseconds after the previous one,
+ * as recommended by RFC 8305. */
+#define ROS_CONNECT_ATTEMPTS_MAX 16
+#define ROS_CONNECT_ATTEMPT_DELAY 250
+
+/* Maximum size of the key of a value passed to the word sink. */
+#define ROS_SINK_KEY_SIZE 256
+
+/* Replies with fewer parameters are searched linearly. */
+#define ROS_REPLY_INDEX_MIN 8
 
 /*
  * Private structures
  */
+struct ros_word_s
+{
+	/* Offset of the first byte of the word, relative to recv_pos. */
+	size_t offset;
+	size_t length;
+};
+typedef struct ros_word_s ros_word_t;
+
+/* Memory for replies is allocated from an arena: a list of blocks that are
+ * freed all at once after the reply handler returns. */
+union arena_align_u
+{
+	void *ptr;
+	uint64_t u64;
+	double d;
+};
+typedef union arena_align_u arena_align_t;
+
+struct arena_block_s;
+typedef struct arena_block_s arena_block_t;
+struct arena_block_s
+{
+	arena_block_t *next;
+	size_t size;
+	size_t used;
+	arena_align_t data[];
+};
+
+struct reply_arena_s
+{
+	/* Most recently allocated block first. */
+	arena_block_t *head;
+};
+typedef struct reply_arena_s reply_arena_t;
+
+/* Where ros_query() and ros_query_stream() find the result of their query. */
+struct query_result_s
+{
+	_Bool done;
+	int status;
+};
+typedef struct query_result_s query_result_t;
+
+/* A query that has been sent but whose reply has not been received
+ * completely. */
+struct pending_query_s;
+typedef struct pending_query_s pending_query_t;
+struct pending_query_s
+{
+	unsigned int tag;
+	ros_reply_handler_t handler;
+	void *user_data;
+	query_result_t *result;
+
+	/* If true, the handler is called for each sentence. */
+	_Bool stream;
+	/* Set for queries which only end when cancelled, see ros_subscribe. */
+	_Bool subscription;
+	/* Set once "/cancel" has been sent for this query. */
+	_Bool cancelled;
+	/* Set while the handler is running. */
+	_Bool busy;
+	/* Set when the "!done" sentence has been received. */
+	_Bool done;
+	/* Set when the query holds a pin on the receive buffer. */
+	_Bool pinned;
+	/* Receives large values, see ros_query_options_t. */
+	ros_word_sink_t word_sink;
+	void *word_sink_data;
+	size_t word_sink_threshold;
+	/* Number and size of the sentences buffered, see max_reply_sentences. */
+	size_t sentences;
+	size_t bytes;
+	/* Return value of the (first failed) handler call. */
+	int status;
+
+	/* Sentences received but not yet passed to the handler. */
+	reply_arena_t arena;
+	ros_reply_t *head;
+	ros_reply_t *tail;
+
+	pending_query_t *next;
+};
+
 struct ros_connection_s
 {
 	int fd;
+
+	/* One of the ROS_STATE_* constants and, in the failed state, the reason. */
+	int state;
+	int error;
+	/* Set for connections created by ros_connect_start. */
+	_Bool nonblocking;
+
+	/* Used while connecting and logging in. */
+	struct addrinfo *ai_list;
+	struct addrinfo *ai_next;
+	/* Set if ai_list has been copied from the host cache. */
+	_Bool ai_cached;
+	char *username;
+	char *password;
+	/* The login method being tried, one of the HOST_AUTH_* constants. The
+	 * method that worked is recorded in host_cache, using host_node and
+	 * host_service as the key. */
+	int auth;
+	ros_host_cache_t *host_cache;
+	char *host_node;
+	char *host_service;
+
+	/* Receive buffer. The bytes in [recv_pos, recv_fill) have been read from
+	 * the socket but have not been consumed yet. */
+	char *recv_buffer;
+	size_t recv_buffer_size;
+	size_t recv_pos;
+	size_t recv_fill;
+
+	/* Sentence scanner state: the words found so far in the sentence starting
+	 * at recv_pos and the offset of the next length prefix. */
+	ros_word_t *words;
+	size_t words_num;
+	size_t words_size;
+	size_t scan_offset;
+	/* Bytes of a word still to be dropped, e.g. because it is oversized, and
+	 * the error to report for the current sentence because of that. */
+	size_t scan_skip;
+	int scan_status;
+	/* Set while the dropped bytes are the value of a word passed to the word
+	 * sink of the query with tag scan_sink_tag. */
+	_Bool scan_sink;
+	unsigned int scan_sink_tag;
+	char scan_sink_key[ROS_SINK_KEY_SIZE];
+	size_t scan_sink_offset;
+	size_t scan_sink_length;
+
+	/* Reply limits, see ros_connect_opts_t. Zero means no limit. */
+	size_t max_reply_sentences;
+	size_t max_reply_bytes;
+	size_t max_word_size;
+
+	/* Number of outstanding queries with a word sink, and a lower bound of
+	 * their thresholds. */
+	unsigned int sinks_pending;
+	size_t sinks_threshold;
+
+	/* In zero-copy mode, replies point into the receive buffer. The data
+	 * consumed since recv_pin_start, and all retired buffers, must not be
+	 * moved or freed while recv_pins is non-zero. */
+	_Bool zero_copy;
+	unsigned int recv_pins;
+	size_t recv_pin_start;
+	char **recv_retired;
+	size_t recv_retired_num;
+
+	/* Send buffer. The bytes in [send_pos, send_fill) have been encoded but
+	 * not yet been written to the socket. */
+	char *send_buffer;
+	size_t send_buffer_size;
+	size_t send_pos;
+	size_t send_fill;
+	/* If set, query_start() leaves commands in the send buffer, so that they
+	 * are sent together with the following ones. */
+	_Bool cork;
+
+	/* Arena block kept from the previous query for re-use. */
+	arena_block_t *arena_spare;
+
+	/* Outstanding queries, oldest first, and a cache of unused entries. */
+	pending_query_t *pending_head;
+	pending_query_t *pending_tail;
+	pending_query_t *pending_free;
+	unsigned int next_tag;
+	/* First non-zero status of a query started with ros_query_start. */
+	int async_status;
+
+	/* Default timeout of blocking queries, in seconds, and the deadline of the
+	 * running one, in milliseconds of the monotonic clock. Zero means none. */
+	unsigned int query_timeout;
+	uint64_t deadline;
+
+	/* I/O statistics since the connection has been established and of the
+	 * last query. */
+	ros_query_stats_t stats;
+	ros_query_stats_t query_stats;
+};
+
+/* A sequence of words, already encoded with their length prefixes. */
+struct encoded_words_s
+{
+	char *data;
+	size_t data_size;
+	size_t data_fill;
+};
+typedef struct encoded_words_s encoded_words_t;
+
+struct ros_filter_s
+{
+	encoded_words_t words;
+
+	/* Number of results on the device's query stack after these words. Used to
+	 * reject operators lacking operands. */
+	size_t depth;
+};
+
+struct ros_prepared_s
+{
+	/* The command and its fixed arguments. */
+	encoded_words_t words;
 };
 
 struct ros_reply_s
@@ -78,916 +308,3344 @@ struct ros_reply_s
 	char **keys;
 	char **values;
 
-	ros_reply_t *next;
-};
+	/* Hash table mapping keys to parameter indices (plus one, zero marks an
+	 * empty slot). Only built for sentences with many parameters. */
+	unsigned int *index;
+	unsigned int index_size;
 
-struct ros_login_data_s
-{
-	const char *username;
-	const char *password;
+	ros_reply_t *next;
 };
-typedef struct ros_login_data_s ros_login_data_t;
 
 /*
  * Private functions
  */
-static int read_exact (int fd, void *buffer, size_t buffer_size) /* {{{ */
+/* Starts the deadline of a query: "timeout" seconds from now, or none if
+ * "timeout" is zero. */
+static void deadline_set (ros_connection_t *c, unsigned int timeout) /* {{{ */
 {
-	char *buffer_ptr;
-	size_t have_bytes;
+	if (timeout == 0)
+		c->deadline = 0;
+	else
+		c->deadline = clock_now_ms () + (((uint64_t) timeout) * 1000);
+} /* }}} void deadline_set */
 
-	if ((fd < 0) || (buffer == NULL))
-		return (EINVAL);
+static _Bool deadline_expired (const ros_connection_t *c) /* {{{ */
+{
+	return ((c->deadline != 0) && (clock_now_ms () >= c->deadline));
+} /* }}} _Bool deadline_expired */
 
-	if (buffer_size == 0)
-		return (0);
+/* Waits until the socket is ready for "events". Returns ETIMEDOUT if the
+ * deadline of the running query passes first. */
+static int connection_poll (ros_connection_t *c, short events) /* {{{ */
+{
+	struct pollfd pfd;
+	int timeout;
+	int status;
 
-	buffer_ptr = buffer;
-	have_bytes = 0;
-	while (have_bytes < buffer_size)
+	timeout = -1;
+	if (c->deadline != 0)
 	{
-		size_t want_bytes;
-		ssize_t status;
+		uint64_t now = clock_now_ms ();
 
-		want_bytes = buffer_size - have_bytes;
-		errno = 0;
-		status = read (fd, buffer_ptr, want_bytes);
-		if (status < 0)
-		{
-			if (errno == EINTR)
-				continue;
-			else
-				return (errno);
-		} else if (status == 0)
-			return (EINVAL);
-
-		assert (((size_t) status) <= want_bytes);
-		have_bytes += status;
-		buffer_ptr += status;
+		if (now >= c->deadline)
+			return (ETIMEDOUT);
+		else if ((c->deadline - now) > INT_MAX)
+			timeout = INT_MAX;
+		else
+			timeout = (int) (c->deadline - now);
 	}
 
-	return (0);
-} /* }}} int read_exact */
-
-static ros_reply_t *reply_alloc (void) /* {{{ */
-{
-	ros_reply_t *r;
-
-	r = malloc (sizeof (*r));
-	if (r == NULL)
-		return (NULL);
-
-	memset (r, 0, sizeof (*r));
-	r->keys = NULL;
-	r->values = NULL;
-	r->next = NULL;
+	pfd.fd = c->fd;
+	pfd.events = events;
+	pfd.revents = 0;
+	status = poll (&pfd, 1, timeout);
+	if (status < 0)
+		return ((errno == EINTR) ? 0 : errno);
+	if ((status == 0) && deadline_expired (c))
+		return (ETIMEDOUT);
 
-	return (r);
-} /* }}} ros_reply_s *reply_alloc */
+	return (0);
+} /* }}} int connection_poll */
 
-static int reply_add_keyval (ros_reply_t *r, const char *key, /* {{{ */
-		const char *val)
+/* Replaces the receive buffer with a new one because replies still point into
+ * it. The unconsumed data is copied to the new buffer and the old one is kept
+ * until recv_unpin() releases it. */
+static int recv_buffer_retire (ros_connection_t *c) /* {{{ */
 {
+	size_t unconsumed;
+	size_t new_size;
+	char *new_buffer;
 	char **tmp;
 
-	tmp = realloc (r->keys, (r->params_num + 1) * sizeof (*tmp));
-	if (tmp == NULL)
-		return (ENOMEM);
-	r->keys = tmp;
+	unconsumed = c->recv_fill - c->recv_pos;
+	new_size = c->recv_buffer_size;
+	while (new_size <= unconsumed)
+		new_size *= 2;
 
-	tmp = realloc (r->values, (r->params_num + 1) * sizeof (*tmp));
+	tmp = realloc (c->recv_retired,
+			(c->recv_retired_num + 1) * sizeof (*tmp));
 	if (tmp == NULL)
 		return (ENOMEM);
-	r->values = tmp;
+	c->recv_retired = tmp;
 
-	r->keys[r->params_num] = strdup (key);
-	if (r->keys[r->params_num] == NULL)
+	new_buffer = malloc (new_size);
+	if (new_buffer == NULL)
 		return (ENOMEM);
+	memcpy (new_buffer, c->recv_buffer + c->recv_pos, unconsumed);
 
-	r->values[r->params_num] = strdup (val);
-	if (r->values[r->params_num] == NULL)
-	{
-		free (r->keys[r->params_num]);
-		r->keys[r->params_num] = NULL;
-		return (ENOMEM);
-	}
+	c->recv_retired[c->recv_retired_num] = c->recv_buffer;
+	c->recv_retired_num++;
+
+	c->recv_buffer = new_buffer;
+	c->recv_buffer_size = new_size;
+	c->recv_pos = 0;
+	c->recv_fill = unconsumed;
+	c->recv_pin_start = 0;
 
-	r->params_num++;
 	return (0);
-} /* }}} int reply_add_keyval */
+} /* }}} int recv_buffer_retire */
 
-#if WITH_DEBUG
-static void reply_dump (const ros_reply_t *r) /* {{{ */
+/* Makes room for reading more data into the receive buffer. Unconsumed data
+ * is moved to the front of the buffer; if the buffer is completely filled by
+ * a single (incomplete) sentence, it is grown. Pinned data is never moved,
+ * see recv_pin(). */
+static int recv_buffer_make_room (ros_connection_t *c) /* {{{ */
 {
-	if (r == NULL)
-		return;
-
-	printf ("=== BEGIN REPLY ===\n"
-			"Address: %p\n"
-			"Status: %s\n",
-			(void *) r, r->status);
-	if (r->params_num > 0)
+	if ((c->recv_pins > 0) && (c->recv_pin_start < c->recv_pos))
 	{
-		unsigned int i;
-
-		printf ("Arguments:\n");
-		for (i = 0; i < r->params_num; i++)
-			printf (" %3u: %s = %s\n", i, r->keys[i], r->values[i]);
+		if (c->recv_fill < c->recv_buffer_size)
+			return (0);
+		return (recv_buffer_retire (c));
 	}
-	if (r->next != NULL)
-		printf ("Next: %p\n", (void *) r->next);
-	printf ("=== END REPLY ===\n");
-
-	reply_dump (r->next);
-} /* }}} void reply_dump */
-#else
-# define reply_dump(foo) /**/
-#endif
-
-static void reply_free (ros_reply_t *r) /* {{{ */
-{
-	ros_reply_t *next;
-	unsigned int i;
-
-	if (r == NULL)
-		return;
 
-	next = r->next;
-
-	for (i = 0; i < r->params_num; i++)
+	if (c->recv_pos == c->recv_fill)
 	{
-		free (r->keys[i]);
-		free (r->values[i]);
+		c->recv_pos = 0;
+		c->recv_fill = 0;
 	}
+	else if (c->recv_fill == c->recv_buffer_size)
+	{
+		if (c->recv_pos > 0)
+		{
+			memmove (c->recv_buffer, c->recv_buffer + c->recv_pos,
+					c->recv_fill - c->recv_pos);
+			c->recv_fill -= c->recv_pos;
+			c->recv_pos = 0;
+		}
+		else
+		{
+			char *tmp;
 
-	free (r->status);
-	free (r->keys);
-	free (r->values);
+			tmp = realloc (c->recv_buffer, 2 * c->recv_buffer_size);
+			if (tmp == NULL)
+				return (ENOMEM);
+			c->recv_buffer = tmp;
+			c->recv_buffer_size *= 2;
+		}
+	}
 
-	free (r);
+	if (c->recv_pins > 0)
+		c->recv_pin_start = c->recv_pos;
 
-	reply_free (next);
-} /* }}} void reply_free */
+	return (0);
+} /* }}} int recv_buffer_make_room */
 
-static int buffer_init (char **ret_buffer, size_t *ret_buffer_size) /* {{{ */
+/* Reads as much data as is available from the socket into the receive
+ * buffer. */
+static int recv_buffer_read (ros_connection_t *c) /* {{{ */
 {
-	if ((ret_buffer == NULL) || (ret_buffer_size == NULL))
-		return (EINVAL);
-
-	if (*ret_buffer_size < 1)
-		return (EINVAL);
+	ssize_t status;
 
-	return (0);
-} /* }}} int buffer_init */
+	status = recv_buffer_make_room (c);
+	if (status != 0)
+		return (status);
+	assert (c->recv_fill < c->recv_buffer_size);
 
-static int buffer_add (char **ret_buffer, size_t *ret_buffer_size, /* {{{ */
-		const char *string)
-{
-	char *buffer;
-	size_t buffer_size;
-	size_t string_size;
-	size_t req_size;
+	while (42)
+	{
+		errno = 0;
+		status = read (c->fd, c->recv_buffer + c->recv_fill,
+				c->recv_buffer_size - c->recv_fill);
+		c->stats.read_calls++;
+		if (status < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			else
+				return (errno);
+		}
+		else if (status == 0)
+			return (EINVAL);
 
-	if ((ret_buffer == NULL) || (ret_buffer_size == NULL) || (string == NULL))
-		return (EINVAL);
+		break;
+	}
 
-	buffer = *ret_buffer;
-	buffer_size = *ret_buffer_size;
+	c->recv_fill += (size_t) status;
+	c->stats.bytes_received += (uint64_t) status;
 
-	string_size = strlen (string);
-	if (string_size == 0)
-		return (EINVAL);
+	return (0);
+} /* }}} int recv_buffer_read */
 
-	if (string_size >= 0x10000000)
-		req_size = 5 + string_size;
-	else if (string_size >= 0x200000)
-		req_size = 4 + string_size;
-	else if (string_size >= 0x4000)
-		req_size = 3 + string_size;
-	else if (string_size >= 0x80)
-		req_size = 2 + string_size;
-	else
-		req_size = 1 + string_size;
+/* Decodes the length prefix of a word. Returns EAGAIN if "buffer" does not
+ * contain the entire prefix yet. */
+static int word_length_decode (const uint8_t *buffer, /* {{{ */
+		size_t buffer_size,
+		size_t *ret_prefix_size, size_t *ret_word_length)
+{
+	size_t prefix_size;
+	size_t word_length;
+	size_t i;
 
-	if (*ret_buffer_size < req_size)
-		return (ENOMEM);
+	if (buffer_size < 1)
+		return (EAGAIN);
 
-	if (string_size >= 0x10000000)
+	if (buffer[0] == 0xF0)
 	{
-		buffer[0] = 0xF0;
-		buffer[1] = (string_size >> 24) & 0xff;
-		buffer[2] = (string_size >> 16) & 0xff;
-		buffer[3] = (string_size >>  8) & 0xff;
-		buffer[4] = (string_size      ) & 0xff;
-		buffer += 5;
-		buffer_size -= 5;
+		prefix_size = 5;
+		word_length = 0;
+	}
+	else if ((buffer[0] & 0xF0) == 0xE0)
+	{
+		prefix_size = 4;
+		word_length = buffer[0] & 0x0F;
 	}
-	else if (string_size >= 0x200000)
+	else if ((buffer[0] & 0xE0) == 0xC0)
 	{
-		buffer[0] = (string_size >> 24) & 0x1f;
-		buffer[0] |= 0xE0;
-		buffer[1] = (string_size >> 16) & 0xff;
-		buffer[2] = (string_size >>  8) & 0xff;
-		buffer[3] = (string_size      ) & 0xff;
-		buffer += 4;
-		buffer_size -= 4;
+		prefix_size = 3;
+		word_length = buffer[0] & 0x1F;
 	}
-	else if (string_size >= 0x4000)
+	else if ((buffer[0] & 0xC0) == 0x80)
 	{
-		buffer[0] = (string_size >> 16) & 0x3f;
-		buffer[0] |= 0xC0;
-		buffer[1] = (string_size >>  8) & 0xff;
-		buffer[2] = (string_size      ) & 0xff;
-		buffer += 3;
-		buffer_size -= 3;
+		prefix_size = 2;
+		word_length = buffer[0] & 0x3F;
 	}
-	else if (string_size >= 0x80)
+	else if ((buffer[0] & 0x80) == 0)
 	{
-		buffer[0] = (string_size >>  8) & 0x7f;
-		buffer[0] |= 0x80;
-		buffer[1] = (string_size      ) & 0xff;
-		buffer += 2;
-		buffer_size -= 2;
+		prefix_size = 1;
+		word_length = buffer[0];
 	}
-	else /* if (string_size <= 0x7f) */
+	else
 	{
-		buffer[0] = (char) string_size;
-		buffer += 1;
-		buffer_size -= 1;
+		/* First nibble is `F' but second nibble is not `0'. */
+		return (EPROTO);
 	}
 
-	assert (buffer_size >= string_size);
-	memcpy (buffer, string, string_size);
-	buffer += string_size;
-	buffer_size -= string_size;
+	if (buffer_size < prefix_size)
+		return (EAGAIN);
 
-	*ret_buffer = buffer;
-	*ret_buffer_size = buffer_size;
+	for (i = 1; i < prefix_size; i++)
+		word_length = (word_length << 8) | buffer[i];
 
+	*ret_prefix_size = prefix_size;
+	*ret_word_length = word_length;
 	return (0);
-} /* }}} int buffer_add */
+} /* }}} int word_length_decode */
 
-static int buffer_end (char **ret_buffer, size_t *ret_buffer_size) /* {{{ */
+static int scan_add_word (ros_connection_t *c, /* {{{ */
+		size_t offset, size_t length)
 {
-	if ((ret_buffer == NULL) || (ret_buffer_size == NULL))
-		return (EINVAL);
+	if (c->words_num >= c->words_size)
+	{
+		ros_word_t *tmp;
+		size_t tmp_size;
 
-	if (*ret_buffer_size < 1)
-		return (EINVAL);
+		tmp_size = (c->words_size > 0) ? (2 * c->words_size) : 32;
+		tmp = realloc (c->words, tmp_size * sizeof (*tmp));
+		if (tmp == NULL)
+			return (ENOMEM);
+		c->words = tmp;
+		c->words_size = tmp_size;
+	}
 
-	/* Add empty word. */
-	(*ret_buffer)[0] = 0;
-	(*ret_buffer)++;
-	(*ret_buffer_size)--;
+	c->words[c->words_num].offset = offset;
+	c->words[c->words_num].length = length;
+	c->words_num++;
 
 	return (0);
-} /* }}} int buffer_end */
+} /* }}} int scan_add_word */
 
-static int send_command (ros_connection_t *c, /* {{{ */
-		const char *command,
-		size_t args_num, const char * const *args)
+static int discard_handler (ros_connection_t *c, const ros_reply_t *r,
+		void *user_data);
+
+/* Returns true if a streaming query is outstanding. The query a sentence
+ * belongs to is only known once the sentence is complete, so a sentence is
+ * cut short at max_reply_bytes only if it cannot belong to one: streaming
+ * queries don't buffer their replies and are not subject to the limit.
+ * Abandoned queries don't pass their replies on and don't count. */
+static _Bool scan_stream_pending (const ros_connection_t *c) /* {{{ */
 {
-	char buffer[4096];
-	char *buffer_ptr;
-	size_t buffer_size;
+	const pending_query_t *p;
 
-	size_t i;
-	int status;
+	for (p = c->pending_head; p != NULL; p = p->next)
+		if (p->stream && (p->handler != discard_handler))
+			return (1);
 
-	assert (c != NULL);
-	assert (command != NULL);
+	return (0);
+} /* }}} _Bool scan_stream_pending */
 
-	if ((args == NULL) && (args_num > 0))
-		return (EINVAL);
+static _Bool sentence_tag (const ros_connection_t *c, unsigned int *ret_tag);
+static pending_query_t *pending_find (ros_connection_t *c, unsigned int tag);
 
-	/* FIXME: For debugging only */
-	memset (buffer, 0, sizeof (buffer));
+/* Returns the query the sentence being scanned belongs to, if that is known
+ * already: the tag may follow the words passed to the word sink. */
+static pending_query_t *scan_query (ros_connection_t *c) /* {{{ */
+{
+	unsigned int tag;
 
-	buffer_ptr = buffer;
-	buffer_size = sizeof (buffer);
+	if (sentence_tag (c, &tag))
+		return (pending_find (c, tag));
 
-	status = buffer_init (&buffer_ptr, &buffer_size);
-	if (status != 0)
-		return (status);
+	/* Untagged sentences and those whose tag has not been seen yet can
+	 * only belong to the one outstanding query. */
+	if ((c->pending_head != NULL) && (c->pending_head->next == NULL))
+		return (c->pending_head);
 
-	ros_debug ("send_command: command = %s;\n", command);
-	status = buffer_add (&buffer_ptr, &buffer_size, command);
-	if (status != 0)
-		return (status);
+	return (NULL);
+} /* }}} pending_query_t *scan_query */
+
+/* Passes the value of the word at scan_offset to the word sink of its query
+ * instead of buffering it. Only "=key=value" words are handled; "=key=" is
+ * kept as a word with an empty value. Returns ENOENT if the word is not passed
+ * to a sink and EAGAIN if its key has not been received completely. */
+static int scan_sink_word (ros_connection_t *c, /* {{{ */
+		size_t prefix_size, size_t word_length)
+{
+	pending_query_t *p;
+	const char *word;
+	const char *end;
+	size_t available;
+	size_t search;
+	size_t key_length;
+	size_t value_length;
+	int status;
 
-	for (i = 0; i < args_num; i++)
+	word = c->recv_buffer + c->recv_pos + c->scan_offset + prefix_size;
+	available = c->recv_fill - (c->recv_pos + c->scan_offset + prefix_size);
+	if (available < 1)
+		return (EAGAIN);
+	if (word[0] != '=')
+		return (ENOENT);
+
+	/* Look for the end of the key in its first bytes only, so a value
+	 * without one isn't buffered completely. */
+	search = (word_length < sizeof (c->scan_sink_key))
+		? word_length : sizeof (c->scan_sink_key);
+	if (available < search)
 	{
-		if (args[i] == NULL)
-			return (EINVAL);
-
-		ros_debug ("send_command: arg[%zu] = %s;\n", i, args[i]);
-		status = buffer_add (&buffer_ptr, &buffer_size, args[i]);
-		if (status != 0)
-			return (status);
+		end = memchr (word + 1, '=', available - 1);
+		if (end == NULL)
+			return (EAGAIN);
+	}
+	else
+	{
+		end = memchr (word + 1, '=', search - 1);
+		if (end == NULL)
+			return (ENOENT);
 	}
 
-	status = buffer_end (&buffer_ptr, &buffer_size);
+	/* Length of "=key=", and of the value following it. */
+	key_length = (size_t) (end - word) + 1;
+	value_length = word_length - key_length;
+	if (value_length <= c->sinks_threshold)
+		return (ENOENT);
+	/* The tag is needed to find the query. */
+	if ((key_length == 6) && (memcmp (word, "=.tag=", 6) == 0))
+		return (ENOENT);
+
+	/* Abandoned queries have no sink anymore, see pending_sink_clear(). */
+	p = scan_query (c);
+	if ((p == NULL) || (p->word_sink == NULL)
+			|| (value_length <= p->word_sink_threshold))
+		return (ENOENT);
+
+	status = scan_add_word (c, c->scan_offset + prefix_size, key_length);
 	if (status != 0)
 		return (status);
 
-	buffer_ptr = buffer;
-	buffer_size = sizeof (buffer) - buffer_size;
-	while (buffer_size > 0)
+	memcpy (c->scan_sink_key, word + 1, key_length - 2);
+	c->scan_sink_key[key_length - 2] = 0;
+	c->scan_sink = 1;
+	c->scan_sink_tag = p->tag;
+	c->scan_sink_offset = 0;
+	c->scan_sink_length = value_length;
+
+	c->scan_offset += prefix_size + key_length;
+	c->scan_skip = value_length;
+	return (0);
+} /* }}} int scan_sink_word */
+
+/* Scans the receive buffer for a complete sentence, i.e. a list of words
+ * terminated by an empty word. Returns EAGAIN if more data is needed. The
+ * scanner state is kept in the connection object, so the next call continues
+ * where the previous one stopped. Once a sentence has been processed,
+ * scan_consume_sentence() must be called. */
+static int scan_sentence (ros_connection_t *c) /* {{{ */
+{
+	while (42)
 	{
-		ssize_t bytes_written;
+		const uint8_t *ptr;
+		size_t available;
+		size_t prefix_size;
+		size_t word_length;
+		int status;
 
-		errno = 0;
-		bytes_written = write (c->fd, buffer_ptr, buffer_size);
-		if (bytes_written < 0)
+		ptr = (uint8_t *) c->recv_buffer + c->recv_pos + c->scan_offset;
+		available = c->recv_fill - (c->recv_pos + c->scan_offset);
+
+		/* Drop (the rest of) an oversized word without buffering it. */
+		if (c->scan_skip > 0)
 		{
-			if (errno == EAGAIN)
-				continue;
-			else
-				return (errno);
-		}
-		assert (((size_t) bytes_written) <= buffer_size);
+			size_t n;
 
-		buffer_ptr += bytes_written;
-		buffer_size -= bytes_written;
-	} /* while (buffer_size > 0) */
+			n = (c->scan_skip < available) ? c->scan_skip : available;
+			if ((n > 0) && c->scan_sink && (c->scan_status == 0))
+			{
+				pending_query_t *p;
+
+				/* The query may have been abandoned in the meantime. */
+				p = pending_find (c, c->scan_sink_tag);
+				if ((p != NULL) && (p->word_sink != NULL))
+				{
+					status = (*p->word_sink) (c, c->scan_sink_key, (const char *) ptr,
+							n, c->scan_sink_offset, c->scan_sink_length, p->word_sink_data);
+					if (status != 0)
+						c->scan_status = status;
+				}
+			}
+			c->scan_sink_offset += n;
+			memmove ((char *) ptr, ptr + n, available - n);
+			c->recv_fill -= n;
+			c->scan_skip -= n;
+			if (c->scan_skip > 0)
+				return (EAGAIN);
+			c->scan_sink = 0;
+			continue;
+		}
 
-	return (0);
-} /* }}} int send_command */
+		status = word_length_decode (ptr, available,
+				&prefix_size, &word_length);
+		if (status != 0)
+			return (status);
 
-static int read_word (ros_connection_t *c, /* {{{ */
-		char *buffer, size_t *buffer_size)
-{
-	size_t req_size;
-	uint8_t word_length[5];
-	int status;
+		/* Empty word. This ends a `sentence'. */
+		if (word_length == 0)
+		{
+			c->scan_offset += prefix_size;
+			return (0);
+		}
 
-	if ((buffer == NULL) || (*buffer_size < 1))
-		return (EINVAL);
+		if ((c->sinks_pending > 0) && (word_length > c->sinks_threshold))
+		{
+			status = scan_sink_word (c, prefix_size, word_length);
+			if (status == 0)
+				continue;
+			if (status != ENOENT)
+				return (status);
+		}
 
-	assert (c != NULL);
+		if (((c->max_word_size != 0) && (word_length > c->max_word_size))
+				|| ((c->max_reply_bytes != 0) && ((c->scan_offset + prefix_size
+							+ word_length) > c->max_reply_bytes)
+					&& !scan_stream_pending (c)))
+		{
+			ros_debug ("scan_sentence: Dropping word of %zu bytes.\n",
+					word_length);
+			c->scan_status = EMSGSIZE;
+			c->scan_skip = prefix_size + word_length;
+			continue;
+		}
 
-	/* read one byte from the socket */
-	status = read_exact (c->fd, word_length, 1);
-	if (status != 0)
-		return (status);
+		if ((available - prefix_size) < word_length)
+			return (EAGAIN);
 
-	/* Calculate `req_size' */
-	if (((unsigned char) word_length[0]) == 0xF0) /* {{{ */
-	{
-		status = read_exact (c->fd, &word_length[1], 4);
+		status = scan_add_word (c, c->scan_offset + prefix_size, word_length);
 		if (status != 0)
 			return (status);
 
-		req_size = (word_length[1] << 24)
-			| (word_length[2] << 16)
-			| (word_length[3] << 8)
-			| word_length[4];
+		c->scan_offset += prefix_size + word_length;
 	}
-	else if ((word_length[0] & 0xE0) == 0xE0)
-	{
-		status = read_exact (c->fd, &word_length[1], 3);
-		if (status != 0)
-			return (status);
+} /* }}} int scan_sentence */
 
-		req_size = ((word_length[0] & 0x1F) << 24)
-			| (word_length[1] << 16)
-			| (word_length[2] << 8)
-			| word_length[3];
-	}
-	else if ((word_length[0] & 0xC0) == 0xC0)
-	{
-		status = read_exact (c->fd, &word_length[1], 2);
-		if (status != 0)
-			return (status);
+static void scan_consume_sentence (ros_connection_t *c) /* {{{ */
+{
+	c->recv_pos += c->scan_offset;
+	c->scan_offset = 0;
+	c->words_num = 0;
+	c->scan_status = 0;
+} /* }}} void scan_consume_sentence */
+
+/* Pins the data consumed from the receive buffer from now on, so zero-copy
+ * replies can point into it. Calls may be nested; the data is released when
+ * the last pin is removed. */
+static void recv_pin (ros_connection_t *c) /* {{{ */
+{
+	if (c->recv_pins == 0)
+		c->recv_pin_start = c->recv_pos;
+	c->recv_pins++;
+} /* }}} void recv_pin */
 
-		req_size = ((word_length[0] & 0x3F) << 16)
-			| (word_length[1] << 8)
-			| word_length[2];
-	}
-	else if ((word_length[0] & 0x80) == 0x80)
-	{
-		status = read_exact (c->fd, &word_length[1], 1);
-		if (status != 0)
-			return (status);
+static void recv_unpin (ros_connection_t *c) /* {{{ */
+{
+	size_t i;
 
-		req_size = ((word_length[0] & 0x7F) << 8)
-			| word_length[1];
-	}
-	else if ((word_length[0] & 0x80) == 0)
-	{
-		req_size = (size_t) word_length[0];
-	}
-	else
-	{
-		/* First nibble is `F' but second nibble is not `0'. */
-		return (EPROTO);
-	} /* }}} */
+	assert (c->recv_pins > 0);
+	c->recv_pins--;
+	if (c->recv_pins > 0)
+		return;
 
-	if (*buffer_size < req_size)
-		return (ENOMEM);
+	for (i = 0; i < c->recv_retired_num; i++)
+		free (c->recv_retired[i]);
+	c->recv_retired_num = 0;
+} /* }}} void recv_unpin */
+
+/* Allocates "size" bytes from the arena. Memory allocated from an arena is
+ * only freed as a whole, by arena_release(). */
+static void *arena_alloc (reply_arena_t *a, size_t size) /* {{{ */
+{
+	arena_block_t *b;
+	void *ret;
 
-	/* Empty word. This ends a `sentence' and must therefore be valid. */
-	if (req_size == 0)
+	/* Keep all allocations aligned. */
+	size = ((size + sizeof (arena_align_t) - 1) / sizeof (arena_align_t))
+		* sizeof (arena_align_t);
+
+	b = a->head;
+	if ((b == NULL) || ((b->size - b->used) < size))
 	{
-		buffer[0] = 0;
-		*buffer_size = 0;
-		return (0);
+		size_t block_size;
+
+		block_size = ROS_ARENA_BLOCK_SIZE;
+		if ((b != NULL) && (b->size < ROS_ARENA_BLOCK_SIZE_MAX))
+			block_size = 2 * b->size;
+		while (block_size < size)
+		{
+			if (block_size > (SIZE_MAX / 2))
+				return (NULL);
+			block_size *= 2;
+		}
+
+		b = malloc (sizeof (*b) + block_size);
+		if (b == NULL)
+			return (NULL);
+		b->size = block_size;
+		b->used = 0;
+
+		b->next = a->head;
+		a->head = b;
 	}
 
-	status = read_exact (c->fd, buffer, req_size);
-	if (status != 0)
-		return (status);
-	*buffer_size = req_size;
+	ret = ((char *) b->data) + b->used;
+	b->used += size;
 
-	return (0);
-} /* }}} int buffer_decode_next */
+	return (ret);
+} /* }}} void *arena_alloc */
 
-static ros_reply_t *receive_sentence (ros_connection_t *c) /* {{{ */
+static char *arena_word_dup (reply_arena_t *a, /* {{{ */
+		const char *word, size_t word_length)
 {
-	char buffer[4096];
-	size_t buffer_size;
-	int status;
+	char *ret;
 
-	ros_reply_t *r;
-
-	r = reply_alloc ();
-	if (r == NULL)
+	ret = arena_alloc (a, word_length + 1);
+	if (ret == NULL)
 		return (NULL);
 
+	memcpy (ret, word, word_length);
+	ret[word_length] = 0;
+
+	return (ret);
+} /* }}} char *arena_word_dup */
+
+/* Initializes the arena, re-using the block kept by the connection if
+ * available. */
+static void arena_init (ros_connection_t *c, reply_arena_t *a) /* {{{ */
+{
+	a->head = c->arena_spare;
+	c->arena_spare = NULL;
+} /* }}} void arena_init */
+
+/* Frees all memory allocated from the arena. The most recently allocated
+ * block is handed back to the connection for re-use by the next query. */
+static void arena_release (ros_connection_t *c, reply_arena_t *a) /* {{{ */
+{
+	arena_block_t *b;
+
+	b = a->head;
+	a->head = NULL;
+
+	if ((b != NULL) && (c->arena_spare == NULL)
+			&& (b->size <= ROS_ARENA_BLOCK_SIZE_MAX))
+	{
+		arena_block_t *next = b->next;
+
+		b->next = NULL;
+		b->used = 0;
+		c->arena_spare = b;
+
+		b = next;
+	}
+
+	while (b != NULL)
+	{
+		arena_block_t *next = b->next;
+		free (b);
+		b = next;
+	}
+} /* }}} void arena_release */
+
+#if WITH_DEBUG
+static void reply_dump (const ros_reply_t *r) /* {{{ */
+{
+	if (r == NULL)
+		return;
+
+	printf ("=== BEGIN REPLY ===\n"
+			"Address: %p\n"
+			"Status: %s\n",
+			(void *) r, r->status);
+	if (r->params_num > 0)
+	{
+		unsigned int i;
+
+		printf ("Arguments:\n");
+		for (i = 0; i < r->params_num; i++)
+			printf (" %3u: %s = %s\n", i, r->keys[i], r->values[i]);
+	}
+	if (r->next != NULL)
+		printf ("Next: %p\n", (void *) r->next);
+	printf ("=== END REPLY ===\n");
+
+	reply_dump (r->next);
+} /* }}} void reply_dump */
+#else
+# define reply_dump(foo) /**/
+#endif
+
+/* Makes sure at least "size" more bytes can be appended to the send
+ * buffer. */
+static int send_buffer_reserve (ros_connection_t *c, size_t size) /* {{{ */
+{
+	size_t new_size;
+	char *tmp;
+
+	if (c->send_pos == c->send_fill)
+	{
+		c->send_pos = 0;
+		c->send_fill = 0;
+	}
+
+	if ((c->send_buffer_size - c->send_fill) >= size)
+		return (0);
+
+	if (c->send_pos > 0)
+	{
+		memmove (c->send_buffer, c->send_buffer + c->send_pos,
+				c->send_fill - c->send_pos);
+		c->send_fill -= c->send_pos;
+		c->send_pos = 0;
+
+		if ((c->send_buffer_size - c->send_fill) >= size)
+			return (0);
+	}
+
+	new_size = (c->send_buffer_size > 0)
+		? c->send_buffer_size : ROS_SEND_BUFFER_SIZE;
+	while ((new_size - c->send_fill) < size)
+	{
+		if (new_size > (SIZE_MAX / 2))
+			return (ENOMEM);
+		new_size *= 2;
+	}
+
+	tmp = realloc (c->send_buffer, new_size);
+	if (tmp == NULL)
+		return (ENOMEM);
+	c->send_buffer = tmp;
+	c->send_buffer_size = new_size;
+
+	return (0);
+} /* }}} int send_buffer_reserve */
+
+/* Encodes "word_length" as a length prefix. "buffer" must hold at least five
+ * bytes. Returns the number of bytes used. */
+static size_t word_length_encode (uint8_t *buffer, size_t word_length) /* {{{ */
+{
+	if (word_length >= 0x10000000)
+	{
+		buffer[0] = 0xF0;
+		buffer[1] = (word_length >> 24) & 0xff;
+		buffer[2] = (word_length >> 16) & 0xff;
+		buffer[3] = (word_length >>  8) & 0xff;
+		buffer[4] = (word_length      ) & 0xff;
+		return (5);
+	}
+	else if (word_length >= 0x200000)
+	{
+		buffer[0] = ((word_length >> 24) & 0x0f) | 0xE0;
+		buffer[1] = (word_length >> 16) & 0xff;
+		buffer[2] = (word_length >>  8) & 0xff;
+		buffer[3] = (word_length      ) & 0xff;
+		return (4);
+	}
+	else if (word_length >= 0x4000)
+	{
+		buffer[0] = ((word_length >> 16) & 0x1f) | 0xC0;
+		buffer[1] = (word_length >>  8) & 0xff;
+		buffer[2] = (word_length      ) & 0xff;
+		return (3);
+	}
+	else if (word_length >= 0x80)
+	{
+		buffer[0] = ((word_length >>  8) & 0x3f) | 0x80;
+		buffer[1] = (word_length      ) & 0xff;
+		return (2);
+	}
+	else /* if (word_length <= 0x7f) */
+	{
+		buffer[0] = (uint8_t) word_length;
+		return (1);
+	}
+} /* }}} size_t word_length_encode */
+
+static int send_buffer_add (ros_connection_t *c, /* {{{ */
+		const char *word, size_t word_length)
+{
+	int status;
+
+	/* Empty words terminate a sentence and are added by send_buffer_end. */
+	if (word_length == 0)
+		return (EINVAL);
+
+	if (word_length > UINT32_MAX)
+		return (EMSGSIZE);
+
+	status = send_buffer_reserve (c, 5 + word_length);
+	if (status != 0)
+		return (status);
+
+	c->send_fill += word_length_encode (
+			(uint8_t *) c->send_buffer + c->send_fill, word_length);
+	memcpy (c->send_buffer + c->send_fill, word, word_length);
+	c->send_fill += word_length;
+
+	return (0);
+} /* }}} int send_buffer_add */
+
+static int send_buffer_end (ros_connection_t *c) /* {{{ */
+{
+	int status;
+
+	status = send_buffer_reserve (c, 1);
+	if (status != 0)
+		return (status);
+
+	/* Add empty word. */
+	c->send_buffer[c->send_fill] = 0;
+	c->send_fill++;
+
+	return (0);
+} /* }}} int send_buffer_end */
+
+/* Writes as much of the send buffer to the socket as possible without
+ * blocking. Returns zero if the socket would block. */
+static int send_buffer_write (ros_connection_t *c) /* {{{ */
+{
+	while (c->send_pos < c->send_fill)
+	{
+		ssize_t bytes_written;
+
+		errno = 0;
+		bytes_written = write (c->fd, c->send_buffer + c->send_pos,
+				c->send_fill - c->send_pos);
+		c->stats.write_calls++;
+		if (bytes_written < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			else if ((errno == EAGAIN) || (errno == EWOULDBLOCK))
+				return (0);
+			return (errno);
+		}
+		assert (((size_t) bytes_written) <= (c->send_fill - c->send_pos));
+		c->stats.bytes_sent += (uint64_t) bytes_written;
+
+		c->send_pos += (size_t) bytes_written;
+	} /* while (c->send_pos < c->send_fill) */
+
+	c->send_pos = 0;
+	c->send_fill = 0;
+
+	return (0);
+} /* }}} int send_buffer_write */
+
+/* Writes the entire send buffer to the socket. If the socket is not ready for
+ * writing, waits for it using poll(2). */
+static int send_buffer_flush (ros_connection_t *c) /* {{{ */
+{
 	while (42)
 	{
-		buffer_size = sizeof (buffer) - 1;
-		status = read_word (c, buffer, &buffer_size);
-		if (status != 0)
-			break;
-		assert (buffer_size < sizeof (buffer));
-		buffer[buffer_size] = 0;
+		int status;
+
+		status = send_buffer_write (c);
+		if (status != 0)
+			return (status);
+		if (c->send_pos == c->send_fill)
+			break;
+
+		status = connection_poll (c, POLLOUT);
+		if (status != 0)
+			return (status);
+	}
+
+	return (0);
+} /* }}} int send_buffer_flush */
+
+/* Encodes a sentence into the send buffer, tagged with "tag". Upon failure,
+ * the send buffer is left unchanged. */
+static int send_buffer_add_encoded (ros_connection_t *c, /* {{{ */
+		const encoded_words_t *w)
+{
+	int status;
+
+	if (w->data_fill == 0)
+		return (0);
+
+	status = send_buffer_reserve (c, w->data_fill);
+	if (status != 0)
+		return (status);
+
+	memcpy (c->send_buffer + c->send_fill, w->data, w->data_fill);
+	c->send_fill += w->data_fill;
+
+	return (0);
+} /* }}} int send_buffer_add_encoded */
+
+/* Encodes a sentence into the send buffer, tagged with "tag". If "prepared" is
+ * not NULL, its words are used instead of "command" and "args" are appended
+ * to its fixed arguments. Upon failure, the send buffer is left unchanged. */
+static int encode_command (ros_connection_t *c, /* {{{ */
+		const char *command, const ros_prepared_t *prepared,
+		size_t args_num, const char * const *args,
+		const ros_filter_t *filter, unsigned int tag)
+{
+	char tag_word[32];
+	size_t sentence_offset;
+	size_t i;
+	int status;
+
+	assert (c != NULL);
+	assert ((command != NULL) || (prepared != NULL));
+
+	if ((args == NULL) && (args_num > 0))
+		return (EINVAL);
+
+	/* Relative to send_pos, because send_buffer_reserve may move the pending
+	 * data to the front of the buffer. */
+	sentence_offset = c->send_fill - c->send_pos;
+
+	if (prepared != NULL)
+	{
+		ros_debug ("encode_command: prepared = %zu bytes;\n",
+				prepared->words.data_fill);
+		status = send_buffer_add_encoded (c, &prepared->words);
+	}
+	else
+	{
+		ros_debug ("encode_command: command = %s;\n", command);
+		status = send_buffer_add (c, command, strlen (command));
+	}
+
+	for (i = 0; (status == 0) && (i < args_num); i++)
+	{
+		if (args[i] == NULL)
+		{
+			status = EINVAL;
+			break;
+		}
+
+		ros_debug ("encode_command: arg[%zu] = %s;\n", i, args[i]);
+		status = send_buffer_add (c, args[i], strlen (args[i]));
+	}
+
+	if ((status == 0) && (filter != NULL))
+	{
+		ros_debug ("encode_command: filter = %zu bytes;\n",
+				filter->words.data_fill);
+		status = send_buffer_add_encoded (c, &filter->words);
+	}
+
+	if (status == 0)
+	{
+		snprintf (tag_word, sizeof (tag_word), ".tag=%u", tag);
+		status = send_buffer_add (c, tag_word, strlen (tag_word));
+	}
+
+	if (status == 0)
+		status = send_buffer_end (c);
+
+	if (status != 0)
+	{
+		c->send_fill = c->send_pos + sentence_offset;
+		return (status);
+	}
+
+	return (0);
+} /* }}} int encode_command */
+
+/* Makes sure at least "size" more bytes can be appended to "w". */
+static int encoded_words_reserve (encoded_words_t *w, size_t size) /* {{{ */
+{
+	size_t new_size;
+	char *tmp;
+
+	if ((w->data_size - w->data_fill) >= size)
+		return (0);
+
+	new_size = (w->data_size > 0) ? w->data_size : 64;
+	while ((new_size - w->data_fill) < size)
+	{
+		if (new_size > (SIZE_MAX / 2))
+			return (ENOMEM);
+		new_size *= 2;
+	}
+
+	tmp = realloc (w->data, new_size);
+	if (tmp == NULL)
+		return (ENOMEM);
+	w->data = tmp;
+	w->data_size = new_size;
+
+	return (0);
+} /* }}} int encoded_words_reserve */
+
+static int encoded_words_add (encoded_words_t *w, /* {{{ */
+		const char *word, size_t word_length)
+{
+	int status;
+
+	if (word_length == 0)
+		return (EINVAL);
+	if (word_length > UINT32_MAX)
+		return (EMSGSIZE);
+
+	status = encoded_words_reserve (w, 5 + word_length);
+	if (status != 0)
+		return (status);
+
+	w->data_fill += word_length_encode (
+			(uint8_t *) w->data + w->data_fill, word_length);
+	memcpy (w->data + w->data_fill, word, word_length);
+	w->data_fill += word_length;
+
+	return (0);
+} /* }}} int encoded_words_add */
+
+/* Appends the query word "<prefix><key>" or "<prefix><key>=<value>" to the
+ * filter. */
+static int filter_add (ros_filter_t *f, const char *prefix, /* {{{ */
+		const char *key, const char *value)
+{
+	encoded_words_t *w;
+	size_t prefix_len;
+	size_t key_len;
+	size_t value_len;
+	size_t word_len;
+	char *ptr;
+	int status;
+
+	if ((f == NULL) || (key == NULL) || (key[0] == 0))
+		return (EINVAL);
+	/* The key ends at the first equal sign. */
+	if (strchr (key, '=') != NULL)
+		return (EINVAL);
+
+	prefix_len = strlen (prefix);
+	key_len = strlen (key);
+	value_len = (value != NULL) ? strlen (value) : 0;
+
+	word_len = prefix_len + key_len;
+	if (value != NULL)
+		word_len += 1 + value_len;
+	if (word_len > UINT32_MAX)
+		return (EMSGSIZE);
+
+	w = &f->words;
+	status = encoded_words_reserve (w, 5 + word_len);
+	if (status != 0)
+		return (status);
+
+	ptr = w->data + w->data_fill;
+	ptr += word_length_encode ((uint8_t *) ptr, word_len);
+	memcpy (ptr, prefix, prefix_len);
+	ptr += prefix_len;
+	memcpy (ptr, key, key_len);
+	ptr += key_len;
+	if (value != NULL)
+	{
+		*ptr = '=';
+		ptr++;
+		memcpy (ptr, value, value_len);
+		ptr += value_len;
+	}
+
+	w->data_fill = (size_t) (ptr - w->data);
+	f->depth++;
+
+	return (0);
+} /* }}} int filter_add */
+
+/* Returns a null-terminated copy of a word of the current sentence. In
+ * zero-copy mode, the word is terminated in the receive buffer instead. This
+ * overwrites the first byte of the following length prefix, which has already
+ * been decoded by scan_sentence(). */
+static char *sentence_word_dup (ros_connection_t *c, /* {{{ */
+		reply_arena_t *arena, char *word, size_t word_length)
+{
+	if (c->zero_copy)
+	{
+		word[word_length] = 0;
+		return (word);
+	}
+
+	return (arena_word_dup (arena, word, word_length));
+} /* }}} char *sentence_word_dup */
+
+/* Blocks until a complete sentence is available in the receive buffer. */
+static int receive_sentence (ros_connection_t *c) /* {{{ */
+{
+	int status;
+
+	while ((status = scan_sentence (c)) == EAGAIN)
+	{
+		/* With a deadline, don't block in read(2). */
+		if ((c->deadline != 0) && !c->nonblocking)
+		{
+			status = connection_poll (c, POLLIN);
+			if (status != 0)
+				break;
+		}
+
+		status = recv_buffer_read (c);
+		if ((status != EAGAIN) && (status != EWOULDBLOCK))
+		{
+			if (status != 0)
+				break;
+			continue;
+		}
+
+		/* Only sockets of connections created by ros_connect_start are
+		 * non-blocking. Others may fail with EAGAIN if SO_RCVTIMEO expired. */
+		if (!c->nonblocking)
+			break;
+
+		status = connection_poll (c, POLLIN);
+		if (status != 0)
+			break;
+	}
+
+	return (status);
+} /* }}} int receive_sentence */
+
+/* Looks for the ".tag" attribute of the current sentence. Returns zero if
+ * the sentence is not tagged. */
+static _Bool sentence_tag (const ros_connection_t *c, /* {{{ */
+		unsigned int *ret_tag)
+{
+	const char *sentence;
+	size_t i;
+
+	sentence = c->recv_buffer + c->recv_pos;
+	for (i = 0; i < c->words_num; i++)
+	{
+		const char *word = sentence + c->words[i].offset;
+		size_t word_length = c->words[i].length;
+		unsigned int tag;
+		size_t j;
+
+		/* Some versions send the tag as a regular parameter. */
+		if ((word_length > 1) && (word[0] == '='))
+		{
+			word++;
+			word_length--;
+		}
+
+		if ((word_length <= 5) || (memcmp (word, ".tag=", 5) != 0))
+			continue;
+
+		tag = 0;
+		for (j = 5; j < word_length; j++)
+		{
+			if ((word[j] < '0') || (word[j] > '9'))
+				break;
+			tag = (10 * tag) + (unsigned int) (word[j] - '0');
+		}
+		if (j < word_length)
+			continue;
+
+		*ret_tag = tag;
+		return (1);
+	}
+
+	return (0);
+} /* }}} _Bool sentence_tag */
+
+/* Builds the hash table used by ros_reply_param_val_by_key. Uses linear
+ * probing, so of duplicate keys the first one is found, like with a linear
+ * search. The index is optional: if allocating it fails, lookups fall back to
+ * searching linearly. */
+static void reply_index (reply_arena_t *arena, ros_reply_t *r) /* {{{ */
+{
+	unsigned int size;
+	unsigned int i;
+
+	if (r->params_num < ROS_REPLY_INDEX_MIN)
+		return;
+
+	/* Keep the load factor at or below 50%. */
+	size = ROS_REPLY_INDEX_MIN * 2;
+	while (size < (2 * r->params_num))
+		size *= 2;
+
+	r->index = arena_alloc (arena, size * sizeof (*r->index));
+	if (r->index == NULL)
+		return;
+	memset (r->index, 0, size * sizeof (*r->index));
+	r->index_size = size;
+
+	for (i = 0; i < r->params_num; i++)
+	{
+		unsigned int slot = fnv1a (FNV1A_INIT, r->keys[i]) & (size - 1);
+
+		while (r->index[slot] != 0)
+			slot = (slot + 1) & (size - 1);
+		r->index[slot] = i + 1;
+	}
+} /* }}} void reply_index */
+
+/* Converts the current sentence to a reply allocated from "arena" and
+ * consumes it. "*ret_reply" is set to NULL if the sentence has no status. */
+static int sentence_to_reply (ros_connection_t *c, /* {{{ */
+		reply_arena_t *arena, ros_reply_t **ret_reply)
+{
+	char *sentence;
+	unsigned int params_num;
+	size_t i;
+
+	ros_reply_t *r;
+
+	*ret_reply = NULL;
+	sentence = c->recv_buffer + c->recv_pos;
+
+	/* Count the parameters first, so the key and value arrays can be
+	 * allocated with the right size. */
+	params_num = 0;
+	for (i = 0; i < c->words_num; i++)
+		if (sentence[c->words[i].offset] == '=')
+			params_num++;
+
+	r = arena_alloc (arena, sizeof (*r));
+	if (r == NULL)
+	{
+		scan_consume_sentence (c);
+		return (ENOMEM);
+	}
+	memset (r, 0, sizeof (*r));
+
+	if (params_num > 0)
+	{
+		r->keys = arena_alloc (arena, params_num * sizeof (*r->keys));
+		r->values = arena_alloc (arena, params_num * sizeof (*r->values));
+		if ((r->keys == NULL) || (r->values == NULL))
+		{
+			scan_consume_sentence (c);
+			return (ENOMEM);
+		}
+	}
+
+	for (i = 0; i < c->words_num; i++)
+	{
+		char *word = sentence + c->words[i].offset;
+		size_t word_length = c->words[i].length;
+
+		if (word[0] == '!') /* {{{ */
+		{
+			r->status = sentence_word_dup (c, arena, &word[1], word_length - 1);
+			if (r->status == NULL)
+				break;
+		} /* }}} if (word[0] == '!') */
+		else if (word[0] == '=') /* {{{ */
+		{
+			char *key;
+			char *val;
+			unsigned int j;
+
+			key = &word[1];
+			val = memchr (key, '=', word_length - 1);
+			if (val == NULL)
+			{
+				fprintf (stderr, "Ignoring misformed word: %.*s\n",
+						(int) word_length, word);
+				continue;
+			}
+			val++;
+
+			j = r->params_num;
+			r->keys[j] = sentence_word_dup (c, arena, key,
+					(size_t) (val - key) - 1);
+			r->values[j] = sentence_word_dup (c, arena, val,
+					word_length - (size_t) (val - word));
+			if ((r->keys[j] == NULL) || (r->values[j] == NULL))
+				break;
+			r->params_num++;
+		} /* }}} if (word[0] == '=') */
+		else
+		{
+			ros_debug ("sentence_to_reply: Ignoring unknown word: %.*s\n",
+					(int) word_length, word);
+		}
+	}
+
+	scan_consume_sentence (c);
+
+	if (i < c->words_num)
+		return (ENOMEM);
+
+	if (r->status != NULL)
+	{
+		reply_index (arena, r);
+		*ret_reply = r;
+	}
+	return (0);
+} /* }}} int sentence_to_reply */
+
+/* Adds a query to the list of outstanding queries and assigns it a tag. */
+static pending_query_t *pending_add (ros_connection_t *c, /* {{{ */
+		ros_reply_handler_t handler, void *user_data,
+		_Bool stream, query_result_t *result)
+{
+	pending_query_t *p;
+
+	if (c->pending_free != NULL)
+	{
+		p = c->pending_free;
+		c->pending_free = p->next;
+	}
+	else
+	{
+		p = malloc (sizeof (*p));
+		if (p == NULL)
+			return (NULL);
+	}
+	memset (p, 0, sizeof (*p));
+
+	p->tag = c->next_tag++;
+	p->handler = handler;
+	p->user_data = user_data;
+	p->stream = stream;
+	p->result = result;
+	arena_init (c, &p->arena);
+
+	if (c->pending_tail == NULL)
+		c->pending_head = p;
+	else
+		c->pending_tail->next = p;
+	c->pending_tail = p;
+
+	return (p);
+} /* }}} pending_query_t *pending_add */
+
+static pending_query_t *pending_find (ros_connection_t *c, /* {{{ */
+		unsigned int tag)
+{
+	pending_query_t *p;
+
+	for (p = c->pending_head; p != NULL; p = p->next)
+		if (p->tag == tag)
+			return (p);
+
+	return (NULL);
+} /* }}} pending_query_t *pending_find */
+
+/* Releases the memory held by the replies of a query. */
+static void pending_reset (ros_connection_t *c, pending_query_t *p) /* {{{ */
+{
+	p->head = NULL;
+	p->tail = NULL;
+
+	if (p->pinned)
+	{
+		recv_unpin (c);
+		p->pinned = 0;
+	}
+	arena_release (c, &p->arena);
+} /* }}} void pending_reset */
+
+/* Sets the word sink of a query from its options. */
+static void pending_sink_set (ros_connection_t *c, pending_query_t *p, /* {{{ */
+		const ros_query_options_t *opts)
+{
+	if ((opts == NULL) || (opts->word_sink == NULL))
+		return;
+
+	p->word_sink = opts->word_sink;
+	p->word_sink_data = opts->word_sink_data;
+	p->word_sink_threshold = opts->word_sink_threshold;
+
+	if ((c->sinks_pending == 0)
+			|| (opts->word_sink_threshold < c->sinks_threshold))
+		c->sinks_threshold = opts->word_sink_threshold;
+	c->sinks_pending++;
+} /* }}} void pending_sink_set */
+
+/* Removes the word sink of a query, e.g. because it has been abandoned and
+ * the rest of its reply is discarded. */
+static void pending_sink_clear (ros_connection_t *c, /* {{{ */
+		pending_query_t *p)
+{
+	if (p->word_sink == NULL)
+		return;
+
+	p->word_sink = NULL;
+	p->word_sink_data = NULL;
+	assert (c->sinks_pending > 0);
+	c->sinks_pending--;
+} /* }}} void pending_sink_clear */
+
+/* Removes a query from the list of outstanding queries and frees it. */
+static void pending_remove (ros_connection_t *c, pending_query_t *p) /* {{{ */
+{
+	pending_query_t *prev;
+
+	prev = NULL;
+	if (c->pending_head != p)
+		for (prev = c->pending_head; prev != NULL; prev = prev->next)
+			if (prev->next == p)
+				break;
+
+	if (prev == NULL)
+		c->pending_head = p->next;
+	else
+		prev->next = p->next;
+	if (c->pending_tail == p)
+		c->pending_tail = prev;
+
+	pending_reset (c, p);
+	pending_sink_clear (c, p);
+
+	p->next = c->pending_free;
+	c->pending_free = p;
+} /* }}} void pending_remove */
+
+/* Called once the "!done" sentence of a query has been received and, for
+ * streaming queries, all sentences have been delivered. */
+static void pending_complete (ros_connection_t *c, pending_query_t *p) /* {{{ */
+{
+	if (!p->stream)
+	{
+		/* Call the callback function with the data we received. */
+		p->busy = 1;
+		p->status = (*p->handler) (c, p->head, p->user_data);
+		p->busy = 0;
+	}
+
+	if (p->result != NULL)
+	{
+		p->result->done = 1;
+		p->result->status = p->status;
+	}
+	else if (c->async_status == 0)
+	{
+		c->async_status = p->status;
+	}
+
+	pending_remove (c, p);
+} /* }}} void pending_complete */
+
+static int query_cancel (ros_connection_t *c, pending_query_t *p);
+
+/* Calls the handler of a streaming query for each sentence received so far.
+ * Sentences arriving while the handler is running, e.g. because it sends a
+ * query itself, are queued and delivered by the outermost call. */
+static void pending_stream_deliver (ros_connection_t *c, /* {{{ */
+		pending_query_t *p)
+{
+	if (p->busy)
+		return;
+
+	p->busy = 1;
+	while (p->head != NULL)
+	{
+		ros_reply_t *r;
+
+		r = p->head;
+		p->head = r->next;
+		if (p->head == NULL)
+			p->tail = NULL;
+		r->next = NULL;
+
+		/* Once the handler failed, the rest of the reply is discarded. */
+		if (p->status == 0)
+			p->status = (*p->handler) (c, r, p->user_data);
+	}
+	p->busy = 0;
+
+	/* Subscriptions would go on forever. */
+	if ((p->status != 0) && p->subscription && !p->cancelled && !p->done)
+		query_cancel (c, p);
+
+	/* Recycle the memory used by the delivered sentences. */
+	pending_reset (c, p);
+	arena_init (c, &p->arena);
+} /* }}} void pending_stream_deliver */
+
+static int discard_handler (__attribute__((unused)) ros_connection_t *c, /* {{{ */
+		__attribute__((unused)) const ros_reply_t *r,
+		__attribute__((unused)) void *user_data)
+{
+	return (0);
+} /* }}} int discard_handler */
+
+/* Returns true if the current sentence is a "!done" sentence. */
+static _Bool sentence_is_done (const ros_connection_t *c) /* {{{ */
+{
+	const char *word;
+
+	if (c->words_num < 1)
+		return (0);
+
+	word = c->recv_buffer + c->recv_pos + c->words[0].offset;
+	return ((c->words[0].length == 5) && (memcmp (word, "!done", 5) == 0));
+} /* }}} _Bool sentence_is_done */
+
+/* Returns true if buffering the current sentence for "p" would exceed the
+ * reply limits. Streaming queries don't buffer their replies. */
+static _Bool pending_over_limit (const ros_connection_t *c, /* {{{ */
+		const pending_query_t *p)
+{
+	if (c->scan_status != 0)
+		return (1);
+	/* The final "!done" is not counted, so a reply of exactly
+	 * max_reply_sentences data sentences is accepted. */
+	if (p->stream || sentence_is_done (c))
+		return (0);
+
+	if ((c->max_reply_sentences != 0)
+			&& (p->sentences >= c->max_reply_sentences))
+		return (1);
+	if ((c->max_reply_bytes != 0)
+			&& ((p->bytes + c->scan_offset) > c->max_reply_bytes))
+		return (1);
+
+	return (0);
+} /* }}} _Bool pending_over_limit */
+
+/* Drops the current sentence, which would exceed the reply limits of "p" or
+ * lost a value the word sink failed on. The query fails with EMSGSIZE or the
+ * status returned by the sink: replies buffered so far are released, the
+ * device is asked to stop and the rest of the reply is discarded as it
+ * arrives, so that the connection stays in sync. */
+static int pending_overflow (ros_connection_t *c, pending_query_t *p) /* {{{ */
+{
+	_Bool done;
+	int status;
+
+	status = (c->scan_status != 0) ? c->scan_status : EMSGSIZE;
+	done = sentence_is_done (c);
+	scan_consume_sentence (c);
+
+	if ((p->handler != discard_handler) && (p->status == 0))
+	{
+		ros_debug ("pending_overflow: Reply of query %u failed with status %i.\n",
+				p->tag, status);
+		p->status = status;
+	}
+
+	if (!p->stream && !p->busy)
+	{
+		pending_reset (c, p);
+		arena_init (c, &p->arena);
+		p->handler = discard_handler;
+		p->stream = 1;
+	}
+	pending_sink_clear (c, p);
+
+	if (done)
+	{
+		p->done = 1;
+		if (!p->busy)
+			pending_complete (c, p);
+		return (0);
+	}
+
+	if (!p->cancelled)
+		return (query_cancel (c, p));
+	return (0);
+} /* }}} int pending_overflow */
+
+/* Passes the sentence found by scan_sentence() on to the query it belongs
+ * to. */
+static int dispatch_current (ros_connection_t *c) /* {{{ */
+{
+	pending_query_t *p;
+	ros_reply_t *r;
+	unsigned int tag;
+	int status;
+
+	/* Untagged sentences are attributed to the oldest query. */
+	if (sentence_tag (c, &tag))
+		p = pending_find (c, tag);
+	else
+		p = c->pending_head;
+
+	if (p == NULL)
+	{
+		ros_debug ("dispatch_current: Discarding sentence without query.\n");
+		scan_consume_sentence (c);
+		return (0);
+	}
+
+	if (pending_over_limit (c, p))
+		return (pending_overflow (c, p));
+
+	if (c->zero_copy && !p->pinned)
+	{
+		recv_pin (c);
+		p->pinned = 1;
+	}
+
+	p->sentences++;
+	p->bytes += c->scan_offset;
+
+	status = sentence_to_reply (c, &p->arena, &r);
+	if (status != 0)
+		return (status);
+	if (r == NULL)
+		return (0);
+
+	if (p->tail == NULL)
+		p->head = r;
+	else
+		p->tail->next = r;
+	p->tail = r;
+
+	if (strcmp ("done", r->status) == 0)
+		p->done = 1;
+
+	if (p->stream)
+		pending_stream_deliver (c, p);
+
+	if (p->done && !p->busy)
+		pending_complete (c, p);
+
+	return (0);
+} /* }}} int dispatch_current */
+
+/* Marks the connection as unusable, e.g. because the sentence stream is out
+ * of sync after an I/O error. */
+static void connection_fail (ros_connection_t *c, int status) /* {{{ */
+{
+	if (c->state == ROS_STATE_FAILED)
+		return;
+
+	c->state = ROS_STATE_FAILED;
+	c->error = status;
+} /* }}} void connection_fail */
+
+/* Receives one sentence and passes it on to the query it belongs to. */
+static int dispatch_sentence (ros_connection_t *c) /* {{{ */
+{
+	int status;
+
+	status = receive_sentence (c);
+	/* A receive timeout or an expired deadline leaves the connection usable:
+	 * the scanner continues with the partial sentence next time. */
+	if ((status == EAGAIN) || (status == EWOULDBLOCK))
+		return (status);
+	if ((status == ETIMEDOUT) && deadline_expired (c))
+		return (status);
+
+	if (status == 0)
+		status = dispatch_current (c);
+	if (status != 0)
+		connection_fail (c, status);
+
+	return (status);
+} /* }}} int dispatch_sentence */
+
+/* Sends a command and registers it as an outstanding query. */
+static pending_query_t *query_start (ros_connection_t *c, /* {{{ */
+		const char *command, const ros_prepared_t *prepared,
+		size_t args_num, const char * const *args, const ros_filter_t *filter,
+		ros_reply_handler_t handler, void *user_data,
+		_Bool stream, query_result_t *result)
+{
+	pending_query_t *p;
+	int status;
+
+	p = pending_add (c, handler, user_data, stream, result);
+	if (p == NULL)
+	{
+		errno = ENOMEM;
+		return (NULL);
+	}
+
+	status = encode_command (c, command, prepared, args_num, args, filter,
+			p->tag);
+	if (status != 0)
+	{
+		pending_remove (c, p);
+		errno = status;
+		return (NULL);
+	}
+
+	/* Asynchronous queries on non-blocking connections leave the rest of the
+	 * command to ros_connection_process(). */
+	if (c->cork)
+		status = 0;
+	else if (c->nonblocking && (result == NULL))
+		status = send_buffer_write (c);
+	else
+		status = send_buffer_flush (c);
+
+	if (status != 0)
+	{
+		pending_remove (c, p);
+		connection_fail (c, status);
+		errno = status;
+		return (NULL);
+	}
+
+	return (p);
+} /* }}} pending_query_t *query_start */
+
+static int cancel_handler (__attribute__((unused)) ros_connection_t *c, /* {{{ */
+		__attribute__((unused)) const ros_reply_t *r,
+		__attribute__((unused)) void *user_data)
+{
+	/* The device answers with a "!trap" if the query has completed in the
+	 * meantime. Either way, the query ends with a "!done". */
+	return (0);
+} /* }}} int cancel_handler */
+
+/* Asks the device to stop sending replies for the query "p". The query
+ * remains registered until its final "!done" has been received. */
+static int query_cancel (ros_connection_t *c, pending_query_t *p) /* {{{ */
+{
+	const char *args[1];
+	char arg_tag[32];
+
+	snprintf (arg_tag, sizeof (arg_tag), "=tag=%u", p->tag);
+	args[0] = arg_tag;
+
+	p->cancelled = 1;
+	if (query_start (c, "/cancel", /* prepared = */ NULL, 1, args,
+				/* filter = */ NULL, cancel_handler, /* user data = */ NULL,
+				/* stream = */ 0, /* result = */ NULL) == NULL)
+		return (errno);
+
+	return (0);
+} /* }}} int query_cancel */
+
+/* Gives up on the query "p" after its deadline has passed: the handler is not
+ * called anymore, the device is asked to stop and the rest of the reply is
+ * discarded as it arrives. */
+static int query_abandon (ros_connection_t *c, pending_query_t *p) /* {{{ */
+{
+	uint64_t deadline;
+	int status;
+
+	pending_reset (c, p);
+	arena_init (c, &p->arena);
+
+	p->handler = discard_handler;
+	p->user_data = NULL;
+	p->result = NULL;
+	p->stream = 1;
+	p->status = 0;
+	pending_sink_clear (c, p);
+
+	if (p->cancelled)
+		return (0);
+
+	/* Sending "/cancel" is not subject to the deadline. */
+	deadline = c->deadline;
+	c->deadline = 0;
+	status = query_cancel (c, p);
+	c->deadline = deadline;
+
+	return (status);
+} /* }}} int query_abandon */
+
+/* Dispatches sentences until the query "p" has completed. If receiving fails,
+ * a (partial) buffered reply is still passed to the handler. If the deadline
+ * passes, the query is abandoned and ETIMEDOUT is returned. */
+static int query_finish (ros_connection_t *c, /* {{{ */
+		pending_query_t *p, query_result_t *result)
+{
+	int status;
+
+	status = 0;
+	while (!result->done)
+	{
+		status = dispatch_sentence (c);
+		if (status != 0)
+			break;
+	}
+
+	if (result->done)
+		return (result->status);
+
+	if ((status == ETIMEDOUT) && (c->state != ROS_STATE_FAILED))
+	{
+		query_abandon (c, p);
+		return (ETIMEDOUT);
+	}
+
+	if (!p->stream && (p->head != NULL))
+	{
+		pending_complete (c, p);
+		return (result->status);
+	}
+
+	pending_remove (c, p);
+	return (status);
+} /* }}} int query_finish */
+
+/* Orders the addresses for connect_race(), alternating between address
+ * families (RFC 8305, section 4). The first address is of family "family",
+ * if there is one. Returns the number of addresses stored in "ret". */
+static size_t connect_order (struct addrinfo *ai_list, int family, /* {{{ */
+		struct addrinfo **ret, size_t ret_size)
+{
+	struct addrinfo *first[ROS_CONNECT_ATTEMPTS_MAX];
+	struct addrinfo *other[ROS_CONNECT_ATTEMPTS_MAX];
+	size_t first_num = 0;
+	size_t other_num = 0;
+	struct addrinfo *ai_ptr;
+	size_t num;
+	size_t i;
+
+	if (family == AF_UNSPEC)
+		family = ai_list->ai_family;
+
+	for (ai_ptr = ai_list; ai_ptr != NULL; ai_ptr = ai_ptr->ai_next)
+	{
+		if (ai_ptr->ai_family == family)
+		{
+			if (first_num < ROS_CONNECT_ATTEMPTS_MAX)
+				first[first_num++] = ai_ptr;
+		}
+		else if (other_num < ROS_CONNECT_ATTEMPTS_MAX)
+			other[other_num++] = ai_ptr;
+	}
+
+	num = 0;
+	for (i = 0; (i < first_num) || (i < other_num); i++)
+	{
+		if ((i < first_num) && (num < ret_size))
+			ret[num++] = first[i];
+		if ((i < other_num) && (num < ret_size))
+			ret[num++] = other[i];
+	}
+
+	return (num);
+} /* }}} size_t connect_order */
+
+/* Connects to one of "ai_num" addresses. Following RFC 8305 ("Happy
+ * Eyeballs"), the next address is tried after ROS_CONNECT_ATTEMPT_DELAY
+ * milliseconds or as soon as an attempt fails, without giving up on the
+ * attempts in progress. The first connection established wins. Each attempt
+ * fails after "timeout_sec" seconds, zero meaning no timeout. Returns the
+ * connected, blocking socket and its index in "ai", or -1 with errno set. */
+static int connect_race (struct addrinfo **ai, size_t ai_num, /* {{{ */
+		unsigned int timeout_sec, size_t *ret_index)
+{
+	struct pollfd fds[ROS_CONNECT_ATTEMPTS_MAX];
+	size_t index[ROS_CONNECT_ATTEMPTS_MAX];
+	uint64_t deadline[ROS_CONNECT_ATTEMPTS_MAX];
+	size_t fds_num = 0;
+	size_t next = 0;
+	uint64_t next_start = 0;
+	int winner = -1;
+	int status = EHOSTUNREACH;
+	size_t i;
+
+	while (winner < 0)
+	{
+		uint64_t now = clock_now_ms ();
+		int timeout;
+
+		/* Start the next attempt, if it is due. */
+		if ((next < ai_num) && ((fds_num == 0) || (now >= next_start)))
+		{
+			struct addrinfo *ai_ptr = ai[next];
+			int fd;
+
+			next++;
+			next_start = now + ROS_CONNECT_ATTEMPT_DELAY;
+
+			fd = socket (ai_ptr->ai_family, ai_ptr->ai_socktype, ai_ptr->ai_protocol);
+			if (fd < 0)
+			{
+				status = errno;
+				continue;
+			}
+			fcntl (fd, F_SETFL, O_NONBLOCK);
+
+			if (connect (fd, ai_ptr->ai_addr, ai_ptr->ai_addrlen) == 0)
+			{
+				*ret_index = next - 1;
+				winner = fd;
+				break;
+			}
+			if (errno != EINPROGRESS)
+			{
+				status = errno;
+				ros_debug ("connect_race: connect(2) failed.\n");
+				close (fd);
+				continue;
+			}
+
+			fds[fds_num].fd = fd;
+			fds[fds_num].events = POLLOUT;
+			fds[fds_num].revents = 0;
+			index[fds_num] = next - 1;
+			deadline[fds_num] = (timeout_sec > 0)
+				? now + (((uint64_t) timeout_sec) * 1000) : 0;
+			fds_num++;
+		}
+
+		if (fds_num == 0)
+		{
+			if (next < ai_num)
+				continue;
+			break;
+		}
+
+		/* Wait until an attempt completes, times out, or the next one is due. */
+		timeout = -1;
+		if (next < ai_num)
+			timeout = (next_start > now) ? (int) (next_start - now) : 0;
+		for (i = 0; i < fds_num; i++)
+		{
+			int t;
+
+			if (deadline[i] == 0)
+				continue;
+			if (deadline[i] <= now)
+				t = 0;
+			else if ((deadline[i] - now) > INT_MAX)
+				t = INT_MAX;
+			else
+				t = (int) (deadline[i] - now);
+			if ((timeout < 0) || (t < timeout))
+				timeout = t;
+		}
+
+		if ((poll (fds, (nfds_t) fds_num, timeout) < 0) && (errno != EINTR))
+		{
+			status = errno;
+			break;
+		}
+		now = clock_now_ms ();
+
+		i = 0;
+		while (i < fds_num)
+		{
+			int socket_error = 0;
+
+			if (fds[i].revents != 0)
+			{
+				socklen_t len = sizeof (socket_error);
+
+				if (getsockopt (fds[i].fd, SOL_SOCKET, SO_ERROR, &socket_error, &len) != 0)
+					socket_error = errno;
+				if (socket_error == 0)
+				{
+					*ret_index = index[i];
+					winner = fds[i].fd;
+					fds[i] = fds[fds_num - 1];
+					fds_num--;
+					break;
+				}
+			}
+			else if ((deadline[i] != 0) && (now >= deadline[i]))
+				socket_error = ETIMEDOUT;
+
+			if ((socket_error == 0) || (socket_error == EINPROGRESS))
+			{
+				i++;
+				continue;
+			}
+
+			ros_debug ("connect_race: connect(2) failed.\n");
+			status = socket_error;
+			close (fds[i].fd);
+			fds[i] = fds[fds_num - 1];
+			index[i] = index[fds_num - 1];
+			deadline[i] = deadline[fds_num - 1];
+			fds_num--;
+
+			/* Don't wait for the delay after a failed attempt. */
+			next_start = now;
+		}
+	}
+
+	for (i = 0; i < fds_num; i++)
+		close (fds[i].fd);
+
+	if (winner < 0)
+	{
+		errno = status;
+		return (-1);
+	}
+
+	/* convert the socket back to blocking mode */
+	fcntl (winner, F_SETFL, 0);
+	return (winner);
+} /* }}} int connect_race */
+
+/* Resolves "node" and "service". If the host cache has addresses which have
+ * not expired, these are used instead and "*ret_cached" is set. */
+static int resolve_addresses (const char *node, const char *service, /* {{{ */
+		ros_host_cache_t *hc, struct addrinfo **ret_ai_list, _Bool *ret_cached)
+{
+	struct addrinfo  ai_hint;
+	int status;
+
+	*ret_ai_list = host_cache_addresses_get (hc, node, service);
+	*ret_cached = (*ret_ai_list != NULL);
+	if (*ret_cached)
+		return (0);
+
+	memset (&ai_hint, 0, sizeof (ai_hint));
+#ifdef AI_ADDRCONFIG
+	ai_hint.ai_flags |= AI_ADDRCONFIG;
+#endif
+	ai_hint.ai_family = AF_UNSPEC;
+	ai_hint.ai_socktype = SOCK_STREAM;
+
+	status = getaddrinfo (node, service, &ai_hint, ret_ai_list);
+	if (status != 0)
+	{
+		*ret_ai_list = NULL;
+		return (EHOSTUNREACH);
+	}
+	assert (*ret_ai_list != NULL);
+
+	host_cache_addresses_set (hc, node, service, *ret_ai_list);
+	return (0);
+} /* }}} int resolve_addresses */
+
+static void free_addresses (struct addrinfo *ai_list, _Bool cached) /* {{{ */
+{
+	if (ai_list == NULL)
+		return;
+
+	if (cached)
+		free (ai_list);
+	else
+		freeaddrinfo (ai_list);
+} /* }}} void free_addresses */
+
+/* Connects to one of the addresses in "ai_list" and sets the socket options.
+ * "node" and "service" are only used as the host cache key. */
+static int connect_addresses (struct addrinfo *ai_list, /* {{{ */
+		const char *node, const char *service,
+		const ros_connect_opts_t *connect_opts)
+{
+	struct addrinfo *ai_array[ROS_CONNECT_ATTEMPTS_MAX];
+	ros_host_cache_t *hc;
+	size_t ai_num;
+	size_t ai_index;
+	int fd;
+	int status;
+
+	/* Try the address family which worked last time first. */
+	hc = (connect_opts != NULL) ? connect_opts->host_cache : NULL;
+	ai_num = connect_order (ai_list, host_cache_family_get (hc, node, service),
+			ai_array, ROS_CONNECT_ATTEMPTS_MAX);
+
+	/* timeout value of 0 means inf timeout */
+	fd = connect_race (ai_array, ai_num,
+			connect_opts ? connect_opts->connect_timeout : 0, &ai_index);
+	if (fd < 0)
+		return (-1);
+	host_cache_family_set (hc, node, service, ai_array[ai_index]->ai_family);
+
+	/* set receive timeout on the socket if one is set */
+	if (connect_opts && connect_opts->receive_timeout)
+	{
+		struct timeval timeout = {
+			.tv_sec = connect_opts->receive_timeout,
+		};
+
+		if (setsockopt (fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof (timeout)) < 0)
+		{
+			status = errno;
+			ros_debug ("connect_addresses: setsockopt(2) failed.\n");
+			close (fd);
+			errno = status;
+			return (-1);
+		}
+	}
+
+	return (fd);
+} /* }}} int connect_addresses */
+
+static int create_socket (const char *node, const char *service, const ros_connect_opts_t *connect_opts) /* {{{ */
+{
+	struct addrinfo *ai_list;
+	ros_host_cache_t *hc;
+	_Bool cached;
+	int fd;
+	int status;
+
+	ros_debug ("create_socket (node = %s, service = %s);\n",
+			node, service);
+
+	hc = (connect_opts != NULL) ? connect_opts->host_cache : NULL;
+
+	status = resolve_addresses (node, service, hc, &ai_list, &cached);
+	if (status != 0)
+	{
+		errno = status;
+		return (-1);
+	}
+
+	fd = connect_addresses (ai_list, node, service, connect_opts);
+	status = errno;
+	free_addresses (ai_list, cached);
+
+	/* The host may have moved since it was resolved: try again with fresh
+	 * addresses. */
+	if ((fd < 0) && cached)
+	{
+		host_cache_addresses_forget (hc, node, service);
+
+		status = resolve_addresses (node, service, hc, &ai_list, &cached);
+		if (status != 0)
+		{
+			errno = status;
+			return (-1);
+		}
+
+		fd = connect_addresses (ai_list, node, service, connect_opts);
+		status = errno;
+		free_addresses (ai_list, cached);
+	}
+
+	if (fd < 0)
+		errno = status;
+	return (fd);
+} /* }}} int create_socket */
+
+/* Forgets the credentials and records the result of the login. */
+static int login_finish (ros_connection_t *c, int status) /* {{{ */
+{
+	if (c->username != NULL)
+	{
+		memset (c->username, 0, strlen (c->username));
+		free (c->username);
+		c->username = NULL;
+	}
+	if (c->password != NULL)
+	{
+		memset (c->password, 0, strlen (c->password));
+		free (c->password);
+		c->password = NULL;
+	}
+
+	if (status == 0)
+		c->state = ROS_STATE_READY;
+	else
+		connection_fail (c, status);
+
+	return (status);
+} /* }}} int login_finish */
+
+static int login2_handler (ros_connection_t *c, /* {{{ */
+		const ros_reply_t *r, void *user_data)
+{
+	const char *ret;
+	if (r == NULL)
+		return (login_finish (c, EINVAL));
+
+	reply_dump (r);
+
+	/* check if we need to use old auth method */
+	ret = ros_reply_param_val_by_key (r, "ret");
+	if (ret != NULL)
+	{
+		ros_debug ("login2_handler: Reply does contain \"ret\" with challenge parameter.\n"
+				"Falling back to old (pre-v6.43) auth method.\n");
+		/* re-process result with the old handler */
+		return login_handler(c, r, user_data);
+	}
+
+	if (strcmp (r->status, "trap") == 0)
+	{
+		ros_debug ("login2_handler: Logging in failed: %s.\n",
+				ros_reply_param_val_by_key (r, "message"));
+		return (login_finish (c, EACCES));
+	}
+	else if (strcmp (r->status, "done") != 0)
+	{
+		ros_debug ("login2_handler: Unexpected status: %s.\n", r->status);
+		return (login_finish (c, EPROTO));
+	}
+
+	host_cache_auth_set (c->host_cache, c->host_node, c->host_service, c->auth);
+	return (login_finish (c, 0));
+} /* }}} int login2_handler */
+
+static void hash_binary_to_hex (char hex[33], uint8_t binary[16]) /* {{{ */
+{
+	int i;
+
+	for (i = 0; i < 16; i++)
+	{
+		char tmp[3];
+		snprintf (tmp, 3, "%02"PRIx8, binary[i]);
+		tmp[2] = 0;
+		hex[2*i] = tmp[0];
+		hex[2*i+1] = tmp[1];
+	}
+	hex[32] = 0;
+} /* }}} void hash_binary_to_hex */
+
+static void hash_hex_to_binary (uint8_t binary[16], char hex[33]) /* {{{ */
+{
+	int i;
+
+	for (i = 0; i < 16; i++)
+	{
+		char tmp[3];
+
+		tmp[0] = hex[2*i];
+		tmp[1] = hex[2*i + 1];
+		tmp[2] = 0;
+
+		binary[i] = (uint8_t) strtoul (tmp, /* endptr = */ NULL, /* base = */ 16);
+	}
+} /* }}} void hash_hex_to_binary */
+
+static void make_password_hash (char response_hex[33], /* {{{ */
+		const char *password, size_t password_length, char challenge_hex[33])
+{
+	uint8_t challenge_bin[16];
+	uint8_t response_bin[16];
+	char data_buffer[password_length+17];
+	MD5_CTX md5;
+
+	hash_hex_to_binary (challenge_bin, challenge_hex);
+
+	data_buffer[0] = 0;
+	memcpy (&data_buffer[1], password, password_length);
+	memcpy (&data_buffer[1+password_length], challenge_bin, 16);
+
+	MD5_Init (&md5);
+	MD5_Update (&md5, data_buffer, sizeof (data_buffer));
+	MD5_Final (response_bin, &md5);
+
+	hash_binary_to_hex (response_hex, response_bin);
+} /* }}} void make_password_hash */
+
+static int login_handler (ros_connection_t *c, const ros_reply_t *r, /* {{{ */
+		__attribute__((unused)) void *user_data)
+{
+	const char *ret;
+	char challenge_hex[33];
+	char response_hex[33];
+
+	const char *params[2];
+	char param_name[1024];
+	char param_response[64];
+
+	if (r == NULL)
+		return (login_finish (c, EINVAL));
+
+	/* The expected result looks like this:
+	 * -- 8< --
+	 *  !done 
+	 *  =ret=ebddd18303a54111e2dea05a92ab46b4
+	 * -- >8 --
+	 */
+	reply_dump (r);
+
+	if (strcmp (r->status, "done") != 0)
+	{
+		ros_debug ("login_handler: Unexpected status: %s.\n", r->status);
+		return (login_finish (c, EPROTO));
+	}
+
+	if ((c->username == NULL) || (c->password == NULL))
+		return (login_finish (c, EINVAL));
+
+	ret = ros_reply_param_val_by_key (r, "ret");
+	if (ret == NULL)
+	{
+		ros_debug ("login_handler: Reply does not have parameter \"ret\".\n");
+		return (login_finish (c, EPROTO));
+	}
+	ros_debug ("login_handler: ret = %s;\n", ret);
+
+	if (strlen (ret) != 32)
+	{
+		ros_debug ("login_handler: Unexpected length of the \"ret\" argument.\n");
+		return (login_finish (c, EPROTO));
+	}
+	strcpy (challenge_hex, ret);
+
+	make_password_hash (response_hex, 
+			c->password, strlen (c->password),
+			challenge_hex);
+
+	snprintf (param_name, sizeof (param_name), "=name=%s", c->username);
+	snprintf (param_response, sizeof (param_response),
+			"=response=00%s", response_hex);
+	params[0] = param_name;
+	params[1] = param_response;
+	c->auth = HOST_AUTH_CHALLENGE;
+
+	/* Don't wait for the reply: this may be called from
+	 * ros_connection_process(). The login is complete once login2_handler
+	 * has been called. */
+	if (query_start (c, "/login", /* prepared = */ NULL, 2, params,
+				/* filter = */ NULL, login2_handler, /* user data = */ NULL,
+				/* stream = */ 0, /* result = */ NULL) == NULL)
+		return (login_finish (c, errno));
+
+	return (0);
+} /* }}} int login_handler */
+
+/* Sends the login command using the post-v6.43 method, i.e. with username and
+ * password filled in. Older devices reply with a challenge, in which case
+ * login_handler() retries using the old method. */
+static int login_plain (ros_connection_t *c) /* {{{ */
+{
+	const char *params[2];
+	char param_username[1024];
+	char param_password[1024];
+
+	snprintf (param_username, sizeof (param_username), "=name=%s", c->username);
+	snprintf (param_password, sizeof (param_password), "=password=%s", c->password);
+	params[0] = param_username;
+	params[1] = param_password;
+	c->auth = HOST_AUTH_PLAIN;
+
+	if (query_start (c, "/login", /* prepared = */ NULL, 2, params,
+				/* filter = */ NULL, login2_handler, /* user data = */ NULL,
+				/* stream = */ 0, /* result = */ NULL) == NULL)
+		return (login_finish (c, errno));
+
+	return (0);
+} /* }}} int login_plain */
+
+/* Handles the reply to a "/login" without arguments. If the device does not
+ * send a challenge, it has been upgraded since the host cache was updated. */
+static int login_challenge_handler (ros_connection_t *c, /* {{{ */
+		const ros_reply_t *r, void *user_data)
+{
+	if (r == NULL)
+		return (login_finish (c, EINVAL));
+
+	if (ros_reply_param_val_by_key (r, "ret") != NULL)
+		return (login_handler (c, r, user_data));
+
+	ros_debug ("login_challenge_handler: Reply does not contain a challenge.\n"
+			"Falling back to the post-v6.43 auth method.\n");
+	return (login_plain (c));
+} /* }}} int login_challenge_handler */
+
+/* Sends the login command. If the host cache says that the device needs the
+ * old method, the challenge is requested right away and the password is never
+ * sent in clear text. */
+static int login_start (ros_connection_t *c) /* {{{ */
+{
+	c->state = ROS_STATE_LOGIN;
+
+	if (host_cache_auth_get (c->host_cache, c->host_node, c->host_service)
+			!= HOST_AUTH_CHALLENGE)
+		return (login_plain (c));
+
+	c->auth = HOST_AUTH_CHALLENGE;
+	if (query_start (c, "/login", /* prepared = */ NULL, 0, /* args = */ NULL,
+				/* filter = */ NULL, login_challenge_handler, /* user data = */ NULL,
+				/* stream = */ 0, /* result = */ NULL) == NULL)
+		return (login_finish (c, errno));
+
+	return (0);
+} /* }}} int login_start */
+
+/* Starts a non-blocking connect to the next address returned by
+ * getaddrinfo(). */
+static int connect_next_address (ros_connection_t *c) /* {{{ */
+{
+	int status;
+
+	status = EHOSTUNREACH;
+	while (c->ai_next != NULL)
+	{
+		struct addrinfo *ai_ptr = c->ai_next;
+		int fd;
+
+		c->ai_next = ai_ptr->ai_next;
+
+		fd = socket (ai_ptr->ai_family, ai_ptr->ai_socktype, ai_ptr->ai_protocol);
+		if (fd < 0)
+		{
+			status = errno;
+			continue;
+		}
+		fcntl (fd, F_SETFL, O_NONBLOCK);
+
+		if ((connect (fd, ai_ptr->ai_addr, ai_ptr->ai_addrlen) == 0)
+				|| (errno == EINPROGRESS))
+		{
+			c->fd = fd;
+			return (0);
+		}
+
+		status = errno;
+		ros_debug ("connect_next_address: connect(2) failed.\n");
+		close (fd);
+	}
+
+	return (status);
+} /* }}} int connect_next_address */
+
+/* Called when the connecting socket becomes writable. */
+static int connect_finish (ros_connection_t *c) /* {{{ */
+{
+	int socket_error;
+	socklen_t len = sizeof (socket_error);
+
+	if (getsockopt (c->fd, SOL_SOCKET, SO_ERROR, &socket_error, &len) != 0)
+		socket_error = errno;
+
+	if (socket_error == EINPROGRESS)
+		return (0);
+
+	if (socket_error != 0)
+	{
+		int status;
+
+		ros_debug ("connect_finish: connect(2) failed.\n");
+		close (c->fd);
+		c->fd = -1;
+
+		status = connect_next_address (c);
+		if (status != 0)
+		{
+			if (c->ai_cached)
+				host_cache_addresses_forget (c->host_cache,
+						c->host_node, c->host_service);
+			return (login_finish (c, socket_error));
+		}
+		return (0);
+	}
+
+	free_addresses (c->ai_list, c->ai_cached);
+	c->ai_list = NULL;
+	c->ai_next = NULL;
+
+	return (login_start (c));
+} /* }}} int connect_finish */
+
+static ros_connection_t *connection_alloc (const char *node, /* {{{ */
+		const char *service, const char *username, const char *password,
+		const ros_connect_opts_t *connect_opts)
+{
+	ros_connection_t *c;
+
+	c = malloc (sizeof (*c));
+	if (c == NULL)
+		return (NULL);
+	memset (c, 0, sizeof (*c));
+
+	c->fd = -1;
+	c->state = ROS_STATE_CONNECTING;
+
+	c->recv_buffer = malloc (ROS_RECV_BUFFER_SIZE);
+	c->username = sstrdup (username);
+	c->password = sstrdup (password);
+	if ((c->recv_buffer == NULL) || (c->username == NULL)
+			|| (c->password == NULL))
+	{
+		ros_disconnect (c);
+		errno = ENOMEM;
+		return (NULL);
+	}
+	c->recv_buffer_size = ROS_RECV_BUFFER_SIZE;
+
+	if (connect_opts != NULL)
+	{
+		c->zero_copy = connect_opts->zero_copy;
+		c->query_timeout = connect_opts->query_timeout;
+		c->max_reply_sentences = connect_opts->max_reply_sentences;
+		c->max_reply_bytes = connect_opts->max_reply_bytes;
+		c->max_word_size = connect_opts->max_word_size;
+	}
+
+	if ((connect_opts != NULL) && (connect_opts->host_cache != NULL))
+	{
+		c->host_cache = connect_opts->host_cache;
+		c->host_node = sstrdup (node);
+		c->host_service = sstrdup (service);
+		if ((c->host_node == NULL) || (c->host_service == NULL))
+		{
+			ros_disconnect (c);
+			errno = ENOMEM;
+			return (NULL);
+		}
+	}
+
+	return (c);
+} /* }}} ros_connection_t *connection_alloc */
+
+/* Logs in using the connected socket "fd", which is closed on failure. */
+static ros_connection_t *connect_login (int fd, /* {{{ */
+		const char *node, const char *service,
+		const char *username, const char *password,
+		const ros_connect_opts_t *connect_opts)
+{
+	ros_connection_t *c;
+	int status;
+
+	c = connection_alloc (node, service, username, password, connect_opts);
+	if (c == NULL)
+	{
+		close (fd);
+		return (NULL);
+	}
+	c->fd = fd;
+
+	status = login_start (c);
+	while ((status == 0) && (c->state == ROS_STATE_LOGIN))
+		status = dispatch_sentence (c);
+
+	if ((status == 0) && (c->state != ROS_STATE_READY))
+		status = c->error;
+	/* Return values of the login handlers are not of interest. */
+	c->async_status = 0;
+
+	if (status != 0)
+	{
+		ros_disconnect (c);
+		errno = status;
+		return (NULL);
+	}
+
+	return (c);
+} /* }}} ros_connection_t *connect_login */
+
+static void query_stats_update (ros_connection_t *c, /* {{{ */
+		const ros_query_stats_t *start)
+{
+	c->query_stats.read_calls = c->stats.read_calls - start->read_calls;
+	c->query_stats.write_calls = c->stats.write_calls - start->write_calls;
+	c->query_stats.bytes_received = c->stats.bytes_received
+		- start->bytes_received;
+	c->query_stats.bytes_sent = c->stats.bytes_sent - start->bytes_sent;
+} /* }}} void query_stats_update */
+
+/* Sends a command and waits for its reply. */
+static int query_run (ros_connection_t *c, /* {{{ */
+		const char *command, const ros_prepared_t *prepared,
+		size_t args_num, const char * const *args,
+		const ros_query_options_t *opts,
+		ros_reply_handler_t handler, void *user_data, _Bool stream)
+{
+	pending_query_t *p;
+	query_result_t result;
+	ros_query_stats_t stats_start;
+	uint64_t deadline_outer;
+	int status;
+
+	if (c->state != ROS_STATE_READY)
+		return (ENOTCONN);
+
+	stats_start = c->stats;
+	memset (&result, 0, sizeof (result));
+
+	/* Handlers may run queries themselves. */
+	deadline_outer = c->deadline;
+	deadline_set (c, ((opts != NULL) && (opts->timeout != 0))
+			? opts->timeout : c->query_timeout);
+
+	p = query_start (c, command, prepared, args_num, args,
+			(opts != NULL) ? opts->filter : NULL,
+			handler, user_data, stream, &result);
+	if (p == NULL)
+	{
+		status = errno;
+	}
+	else
+	{
+		pending_sink_set (c, p, opts);
+		status = query_finish (c, p, &result);
+	}
+
+	c->deadline = deadline_outer;
+	query_stats_update (c, &stats_start);
+
+	return (status);
+} /* }}} int query_run */
+
+/* Returns EINVAL if an entry of a batch lacks the command or handler. */
+static int batch_check (const ros_batch_entry_t *entries, /* {{{ */
+		size_t entries_num)
+{
+	size_t i;
+
+	if ((entries == NULL) && (entries_num > 0))
+		return (EINVAL);
+	for (i = 0; i < entries_num; i++)
+		if ((entries[i].handler == NULL)
+				|| ((entries[i].command == NULL) && (entries[i].prepared == NULL)))
+			return (EINVAL);
+
+	return (0);
+} /* }}} int batch_check */
+
+/* Registers the commands of a batch and appends them to the send buffer. If
+ * this fails, the send buffer and the outstanding queries are left
+ * unchanged. */
+static int batch_encode (ros_connection_t *c, /* {{{ */
+		ros_batch_entry_t *entries, size_t entries_num,
+		pending_query_t **pending, query_result_t *results)
+{
+	size_t sentence_offset;
+	size_t i;
+	int status;
+
+	sentence_offset = c->send_fill - c->send_pos;
+
+	status = 0;
+	for (i = 0; i < entries_num; i++)
+	{
+		entries[i].status = 0;
 
-		/* Empty word means end of reply */
-		if (buffer_size == 0)
+		pending[i] = pending_add (c, entries[i].handler, entries[i].user_data,
+				/* stream = */ 0, results + i);
+		if (pending[i] == NULL)
+		{
+			status = ENOMEM;
 			break;
+		}
 
-		if (buffer[0] == '!') /* {{{ */
-		{
-			if (r->status != NULL)
-				free (r->status);
-			r->status = strdup (&buffer[1]);
-			if (r->status == NULL)
-				break;
-		} /* }}} if (buffer[0] == '!') */
-		else if (buffer[0] == '=') /* {{{ */
+		status = encode_command (c, entries[i].command, entries[i].prepared,
+				entries[i].args_num, entries[i].args, entries[i].filter,
+				pending[i]->tag);
+		if (status != 0)
 		{
-			char *key = &buffer[1];
-			char *val;
-
-			key = &buffer[1];
-			val = strchr (key, '=');
-			if (val == NULL)
-			{
-				fprintf (stderr, "Ignoring misformed word: %s\n", buffer);
-				continue;
-			}
-			*val = 0;
-			val++;
+			pending_remove (c, pending[i]);
+			break;
+		}
+	}
 
-			reply_add_keyval (r, key, val);
-		} /* }}} if (buffer[0] == '=') */
-		else
+	if (status != 0)
+	{
+		/* Nothing has been sent: unregister the encoded commands. */
+		while (i > 0)
 		{
-			ros_debug ("receive_sentence: Ignoring unknown word: %s\n", buffer);
+			i--;
+			pending_remove (c, pending[i]);
 		}
-	} /* while (42) */
-	
-	if (r->status == NULL)
-	{
-		reply_free (r);
-		return (NULL);
+		c->send_fill = c->send_pos + sentence_offset;
 	}
 
-	return (r);
-} /* }}} ros_reply_t *receive_sentence */
+	return (status);
+} /* }}} int batch_encode */
 
-static ros_reply_t *receive_reply (ros_connection_t *c) /* {{{ */
+/* Sets the status of all entries of a batch which will not be answered and,
+ * if "pending" is not NULL, unregisters their queries. */
+static void batch_abort (ros_connection_t *c, /* {{{ */
+		ros_batch_entry_t *entries, size_t entries_num,
+		pending_query_t **pending, int status)
 {
-	ros_reply_t *head;
-	ros_reply_t *tail;
-
-	if (c == NULL)
-		return (NULL);
-
-	head = NULL;
-	tail = NULL;
+	size_t i;
 
-	while (42)
+	for (i = 0; i < entries_num; i++)
 	{
-		ros_reply_t *tmp;
+		if (pending != NULL)
+			pending_remove (c, pending[i]);
+		entries[i].status = status;
+	}
+} /* }}} void batch_abort */
 
-		tmp = receive_sentence (c);
-		if (tmp == NULL)
-			break;
+/* Waits for the replies to a batch which has been sent. Returns the first
+ * non-zero status of the entries. */
+static int batch_wait (ros_connection_t *c, /* {{{ */
+		ros_batch_entry_t *entries, size_t entries_num,
+		pending_query_t **pending, query_result_t *results)
+{
+	_Bool aborted;
+	int abort_status;
+	int ret;
+	size_t i;
 
-		if (tail == NULL)
+	/* The replies may arrive in any order. Once receiving fails, the remaining
+	 * queries are not waited for. */
+	ret = 0;
+	aborted = 0;
+	abort_status = 0;
+	for (i = 0; i < entries_num; i++)
+	{
+		if (results[i].done)
+			entries[i].status = results[i].status;
+		else if (aborted)
 		{
-			head = tmp;
-			tail = tmp;
+			if ((abort_status == ETIMEDOUT) && (c->state != ROS_STATE_FAILED))
+				query_abandon (c, pending[i]);
+			else
+				pending_remove (c, pending[i]);
+			entries[i].status = abort_status;
 		}
 		else
 		{
-			tail->next = tmp;
-			tail = tmp;
+			entries[i].status = query_finish (c, pending[i], results + i);
+			if (!results[i].done || (c->state != ROS_STATE_READY))
+			{
+				aborted = 1;
+				abort_status = (c->state == ROS_STATE_FAILED)
+					? c->error : entries[i].status;
+			}
 		}
 
-		if (strcmp ("done", tmp->status) == 0)
-			break;
-	} /* while (42) */
-	
-	return (head);
-} /* }}} ros_reply_t *receive_reply */
+		if (ret == 0)
+			ret = entries[i].status;
+	}
 
-static int connect_socket_timeout (struct addrinfo *ai_ptr, unsigned int timeout_sec)
-{
-	struct timeval timeout = {
-		.tv_sec = timeout_sec,
-	};
+	return (ret);
+} /* }}} int batch_wait */
 
-	/* value of 0 means no timeout, select treats NULL as no timeout */
-	struct timeval *timeout_ptr = timeout_sec ? &timeout : NULL;
+/*
+ * Public functions
+ */
+ros_connection_t *ros_connect (const char *node, const char *service, /* {{{ */
+		const char *username, const char *password)
+{
+	return ros_connect_with_options(node, service, username, password, NULL);
+} /* }}} ros_connection_t *ros_connect */
 
+ros_connection_t *ros_connect_with_options (const char *node, const char *service, /* {{{ */
+		const char *username, const char *password, const ros_connect_opts_t *connect_opts)
+{
 	int fd;
-	int status;
 
-	fd = socket (ai_ptr->ai_family, ai_ptr->ai_socktype, ai_ptr->ai_protocol);
+	if ((node == NULL) || (username == NULL) || (password == NULL))
+		return (NULL);
+	if (service == NULL)
+		service = ROUTEROS_API_PORT;
+
+	fd = create_socket (node, service, connect_opts);
 	if (fd < 0)
+		return (NULL);
+
+	return (connect_login (fd, node, service, username, password, connect_opts));
+} /* }}} ros_connection_t *ros_connect_with_options */
+
+ros_connection_t *ros_connect_addr (const struct sockaddr *addr, /* {{{ */
+		socklen_t addr_len, const char *username, const char *password,
+		const ros_connect_opts_t *connect_opts)
+{
+	struct addrinfo ai;
+	char node[64];
+	char service[16];
+	int fd;
+
+	if ((addr == NULL) || (username == NULL) || (password == NULL))
 	{
-		ros_debug ("connect_socket_timeout: socket(2) failed.\n");
-		return (0);
+		errno = EINVAL;
+		return (NULL);
 	}
 
-	/* set socket nonblocking just for the connect() - allows us to call select() on connecting socket */
-	fcntl(fd, F_SETFL, O_NONBLOCK);
-
-	status = connect (fd, ai_ptr->ai_addr, ai_ptr->ai_addrlen);
-	if (status != 0 && errno != EINPROGRESS)
+	/* The numeric address is used as the host cache key. */
+	if (getnameinfo (addr, addr_len, node, sizeof (node),
+				service, sizeof (service), NI_NUMERICHOST | NI_NUMERICSERV) != 0)
 	{
-		/* connect() failed due to some reason other than a timeout */
-		ros_debug ("connect_socket_timeout: connect(2) failed.\n");
-		close (fd);
-		return (0);
+		errno = EINVAL;
+		return (NULL);
 	}
 
-	fd_set fdset;
-	FD_ZERO (&fdset);
-	FD_SET (fd, &fdset);
+	memset (&ai, 0, sizeof (ai));
+	ai.ai_family = addr->sa_family;
+	ai.ai_socktype = SOCK_STREAM;
+	ai.ai_addr = (struct sockaddr *) addr;
+	ai.ai_addrlen = addr_len;
 
-	if (select (fd + 1, NULL, &fdset, NULL, timeout_ptr) == 1)
-	{
-		/* find out what happened to the socket */
-		int socket_error;
-		socklen_t len = sizeof (socket_error);
+	fd = connect_addresses (&ai, node, service, connect_opts);
+	if (fd < 0)
+		return (NULL);
 
-		if (getsockopt (fd, SOL_SOCKET, SO_ERROR, &socket_error, &len) != 0)
-		{
-			ros_debug ("connect_socket_timeout: getsockopt(2) failed\n");
-			close (fd);
-			return (0);
-		}
+	return (connect_login (fd, node, service, username, password, connect_opts));
+} /* }}} ros_connection_t *ros_connect_addr */
 
-		if (socket_error != 0)
-		{
-			ros_debug ("connect_socket_timeout: connect(2) failed.\n");
-			close (fd);
+ros_connection_t *ros_connect_start (const char *node, const char *service, /* {{{ */
+		const char *username, const char *password, const ros_connect_opts_t *connect_opts)
+{
+	ros_connection_t *c;
+	int status;
 
-			/* fill in errno so the caller knows what happened */
-			errno = socket_error;
-			return (0);
-		}
+	if ((node == NULL) || (username == NULL) || (password == NULL))
+	{
+		errno = EINVAL;
+		return (NULL);
 	}
-	else
+	if (service == NULL)
+		service = ROUTEROS_API_PORT;
+
+	c = connection_alloc (node, service, username, password, connect_opts);
+	if (c == NULL)
+		return (NULL);
+	c->nonblocking = 1;
+
+	status = resolve_addresses (node, service,
+			(connect_opts != NULL) ? connect_opts->host_cache : NULL,
+			&c->ai_list, &c->ai_cached);
+	if (status != 0)
 	{
-		ros_debug ("connect_socket_timeout: select(2) failed.\n");
-		close (fd);
+		ros_disconnect (c);
+		errno = status;
+		return (NULL);
+	}
+	c->ai_next = c->ai_list;
+
+	status = connect_next_address (c);
+	if (status != 0)
+	{
+		if (c->ai_cached)
+			host_cache_addresses_forget (c->host_cache,
+					c->host_node, c->host_service);
+		ros_disconnect (c);
+		errno = status;
+		return (NULL);
+	}
+
+	return (c);
+} /* }}} ros_connection_t *ros_connect_start */
 
-		/* replace error code as ETIMEDOUT is more representative than EINPROGRESS */
-		if (errno == EINPROGRESS)
-			errno = ETIMEDOUT;
+int ros_connection_fd (const ros_connection_t *c) /* {{{ */
+{
+	if (c == NULL)
+		return (-1);
+	return (c->fd);
+} /* }}} int ros_connection_fd */
+
+int ros_connection_state (const ros_connection_t *c) /* {{{ */
+{
+	if (c == NULL)
+		return (ROS_STATE_FAILED);
+	return (c->state);
+} /* }}} int ros_connection_state */
 
+int ros_connection_events (const ros_connection_t *c) /* {{{ */
+{
+	if ((c == NULL) || (c->fd < 0) || (c->state == ROS_STATE_FAILED))
 		return (0);
-	}
 
-	/* convert the socket back to blocking mode */
-	fcntl (fd, F_SETFL, 0);
-	return (fd);
-} /* }}} int connect_socket_timeout */
+	if (c->state == ROS_STATE_CONNECTING)
+		return (ROS_WANT_WRITE);
 
-static int create_socket (const char *node, const char *service, const ros_connect_opts_t *connect_opts) /* {{{ */
+	if (c->send_pos < c->send_fill)
+		return (ROS_WANT_READ | ROS_WANT_WRITE);
+	return (ROS_WANT_READ);
+} /* }}} int ros_connection_events */
+
+int ros_connection_process (ros_connection_t *c, int events) /* {{{ */
 {
-	struct addrinfo  ai_hint;
-	struct addrinfo *ai_list;
-	struct addrinfo *ai_ptr;
 	int status;
 
-	ros_debug ("create_socket (node = %s, service = %s);\n",
-			node, service);
-
-	memset (&ai_hint, 0, sizeof (ai_hint));
-#ifdef AI_ADDRCONFIG
-	ai_hint.ai_flags |= AI_ADDRCONFIG;
-#endif
-	ai_hint.ai_family = AF_UNSPEC;
-	ai_hint.ai_socktype = SOCK_STREAM;
+	if (c == NULL)
+		return (EINVAL);
 
-	ai_list = NULL;
-	status = getaddrinfo (node, service, &ai_hint, &ai_list);
-	if (status != 0)
-		return (-1);
-	assert (ai_list != NULL);
+	if (c->state == ROS_STATE_FAILED)
+		return (c->error);
 
-	for (ai_ptr = ai_list; ai_ptr != NULL; ai_ptr = ai_ptr->ai_next)
+	if (c->state == ROS_STATE_CONNECTING)
 	{
-		int fd;
+		if ((events & ROS_WANT_WRITE) == 0)
+			return (0);
+		return (connect_finish (c));
+	}
 
-		/* timeout value of 0 means inf timeout */
-		fd = connect_socket_timeout (ai_ptr, connect_opts ? connect_opts->connect_timeout : 0);
-		if (fd == 0)
-		{
-			/* connection failed, try the next host */
-			continue;
-		}
+	status = 0;
+	if ((events & ROS_WANT_WRITE) && (c->send_pos < c->send_fill))
+		status = send_buffer_write (c);
 
-		/* set receive timeout on the socket if one is set */
-		if (connect_opts && connect_opts->receive_timeout)
-		{
-			struct timeval timeout = {
-				.tv_sec = connect_opts->receive_timeout,
-			};
+	if ((status == 0) && (events & ROS_WANT_READ))
+	{
+		status = recv_buffer_read (c);
+		if ((status == EAGAIN) || (status == EWOULDBLOCK))
+			status = 0;
 
-			if (setsockopt (fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof (timeout)) < 0)
+		/* Dispatch all complete sentences. */
+		while ((status == 0) && (c->state != ROS_STATE_FAILED))
+		{
+			status = scan_sentence (c);
+			if (status == EAGAIN)
 			{
-				ros_debug ("create_socket: setsockopt(2) failed.\n");
-				close (fd);
-				continue;
+				status = 0;
+				break;
 			}
+			else if (status == 0)
+				status = dispatch_current (c);
 		}
+	}
 
-		freeaddrinfo (ai_list);
-		return (fd);
+	if (status != 0)
+		connection_fail (c, status);
+
+	if (c->state == ROS_STATE_FAILED)
+		return (c->error);
+	return (0);
+} /* }}} int ros_connection_process */
+
+int ros_disconnect (ros_connection_t *c) /* {{{ */
+{
+	if (c == NULL)
+		return (EINVAL);
+
+	if (c->fd >= 0)
+	{
+		close (c->fd);
+		c->fd = -1;
 	}
 
-	freeaddrinfo (ai_list);
-	return (-1);
-} /* }}} int create_socket */
+	while (c->pending_head != NULL)
+		pending_remove (c, c->pending_head);
+	while (c->pending_free != NULL)
+	{
+		pending_query_t *next = c->pending_free->next;
+		free (c->pending_free);
+		c->pending_free = next;
+	}
 
-static int login2_handler (__attribute__((unused)) ros_connection_t *c, /* {{{ */
-		const ros_reply_t *r, void *user_data)
+	free_addresses (c->ai_list, c->ai_cached);
+	login_finish (c, 0);
+	free (c->host_node);
+	free (c->host_service);
+
+	free (c->recv_buffer);
+	free (c->recv_retired);
+	free (c->words);
+	free (c->send_buffer);
+	free (c->arena_spare);
+	free (c);
+
+	return (0);
+} /* }}} int ros_disconnect */
+
+int ros_query (ros_connection_t *c, /* {{{ */
+		const char *command,
+		size_t args_num, const char * const *args,
+		ros_reply_handler_t handler, void *user_data)
 {
-	const char *ret;
-	if (r == NULL)
+	return (ros_query_with_options (c, command, args_num, args,
+				handler, user_data, /* opts = */ NULL));
+} /* }}} int ros_query */
+
+int ros_query_with_options (ros_connection_t *c, /* {{{ */
+		const char *command,
+		size_t args_num, const char * const *args,
+		ros_reply_handler_t handler, void *user_data,
+		const ros_query_options_t *opts)
+{
+	if ((c == NULL) || (command == NULL) || (handler == NULL))
 		return (EINVAL);
 
-	reply_dump (r);
+	return (query_run (c, command, /* prepared = */ NULL, args_num, args,
+				opts, handler, user_data, /* stream = */ 0));
+} /* }}} int ros_query_with_options */
 
-	/* check if we need to use old auth method */
-	ret = ros_reply_param_val_by_key (r, "ret");
-	if (ret != NULL)
+int ros_query_stream (ros_connection_t *c, /* {{{ */
+		const char *command,
+		size_t args_num, const char * const *args,
+		ros_reply_handler_t handler, void *user_data)
+{
+	if ((c == NULL) || (command == NULL) || (handler == NULL))
+		return (EINVAL);
+
+	return (query_run (c, command, /* prepared = */ NULL, args_num, args,
+				/* opts = */ NULL, handler, user_data, /* stream = */ 1));
+} /* }}} int ros_query_stream */
+
+int ros_query_start (ros_connection_t *c, /* {{{ */
+		const char *command,
+		size_t args_num, const char * const *args,
+		ros_reply_handler_t handler, void *user_data)
+{
+	return (ros_query_start_with_options (c, command, args_num, args,
+				handler, user_data, /* opts = */ NULL));
+} /* }}} int ros_query_start */
+
+int ros_query_start_with_options (ros_connection_t *c, /* {{{ */
+		const char *command,
+		size_t args_num, const char * const *args,
+		ros_reply_handler_t handler, void *user_data,
+		const ros_query_options_t *opts)
+{
+	pending_query_t *p;
+
+	if ((c == NULL) || (command == NULL) || (handler == NULL))
+		return (EINVAL);
+	if (c->state != ROS_STATE_READY)
+		return (ENOTCONN);
+
+	p = query_start (c, command, /* prepared = */ NULL, args_num, args,
+			(opts != NULL) ? opts->filter : NULL, handler, user_data,
+			/* stream = */ 0, /* result = */ NULL);
+	if (p == NULL)
+		return (errno);
+	pending_sink_set (c, p, opts);
+
+	return (0);
+} /* }}} int ros_query_start_with_options */
+
+int ros_query_batch (ros_connection_t *c, /* {{{ */
+		ros_batch_entry_t *entries, size_t entries_num)
+{
+	pending_query_t **pending;
+	query_result_t *results;
+	ros_query_stats_t stats_start;
+	uint64_t deadline_outer;
+	int status;
+
+	if ((c == NULL) || (batch_check (entries, entries_num) != 0))
+		return (EINVAL);
+	if (c->state != ROS_STATE_READY)
+		return (ENOTCONN);
+	if (entries_num == 0)
+		return (0);
+
+	pending = calloc (entries_num, sizeof (*pending));
+	results = calloc (entries_num, sizeof (*results));
+	if ((pending == NULL) || (results == NULL))
+	{
+		free (pending);
+		free (results);
+		return (ENOMEM);
+	}
+
+	stats_start = c->stats;
+
+	/* Encode all commands, then send them with a single flush. */
+	status = batch_encode (c, entries, entries_num, pending, results);
+	if (status != 0)
+	{
+		free (pending);
+		free (results);
+		return (status);
+	}
+
+	/* The timeout applies to the batch as a whole. */
+	deadline_outer = c->deadline;
+	deadline_set (c, c->query_timeout);
+
+	status = send_buffer_flush (c);
+	if (status != 0)
+	{
+		batch_abort (c, entries, entries_num, pending, status);
+		connection_fail (c, status);
+	}
+	else
+		status = batch_wait (c, entries, entries_num, pending, results);
+
+	c->deadline = deadline_outer;
+	query_stats_update (c, &stats_start);
+
+	free (pending);
+	free (results);
+	return (status);
+} /* }}} int ros_query_batch */
+
+ros_connection_t *ros_connect_batch (const char *node, /* {{{ */
+		const char *service, const char *username, const char *password,
+		const ros_connect_opts_t *connect_opts,
+		ros_batch_entry_t *entries, size_t entries_num)
+{
+	ros_connection_t *c;
+	pending_query_t **pending;
+	query_result_t *results;
+	ros_query_stats_t stats_start;
+	_Bool encoded;
+	int auth;
+	int fd;
+	int status;
+
+	if ((node == NULL) || (username == NULL) || (password == NULL)
+			|| (batch_check (entries, entries_num) != 0))
+	{
+		errno = EINVAL;
+		return (NULL);
+	}
+	if (service == NULL)
+		service = ROUTEROS_API_PORT;
+
+	/* One extra element, so that an empty batch does not look like an
+	 * allocation failure. */
+	pending = calloc (entries_num + 1, sizeof (*pending));
+	results = calloc (entries_num + 1, sizeof (*results));
+	if ((pending == NULL) || (results == NULL))
 	{
-		ros_debug ("login2_handler: Reply does contain \"ret\" with challenge parameter.\n"
-				"Falling back to old (pre-v6.43) auth method.\n");
-		/* re-process result with the old handler */
-		return login_handler(c, r, user_data);
+		free (pending);
+		free (results);
+		batch_abort (/* connection = */ NULL, entries, entries_num,
+				/* pending = */ NULL, ENOMEM);
+		errno = ENOMEM;
+		return (NULL);
 	}
 
-	if (strcmp (r->status, "trap") == 0)
+	c = NULL;
+	fd = create_socket (node, service, connect_opts);
+	if (fd < 0)
+		status = errno;
+	else
 	{
-		ros_debug ("login2_handler: Logging in failed: %s.\n",
-				ros_reply_param_val_by_key (r, "message"));
-		return (EACCES);
+		c = connection_alloc (node, service, username, password, connect_opts);
+		if (c == NULL)
+		{
+			status = errno;
+			close (fd);
+		}
+		else
+		{
+			c->fd = fd;
+			status = 0;
+		}
 	}
-	else if (strcmp (r->status, "done") != 0)
+	if (status != 0)
 	{
-		ros_debug ("login2_handler: Unexpected status: %s.\n", r->status);
-		return (EPROTO);
+		batch_abort (/* connection = */ NULL, entries, entries_num,
+				/* pending = */ NULL, status);
+		free (pending);
+		free (results);
+		errno = status;
+		return (NULL);
 	}
+	stats_start = c->stats;
 
-	return (0);
-} /* }}} int login2_handler */
-
-static void hash_binary_to_hex (char hex[33], uint8_t binary[16]) /* {{{ */
-{
-	int i;
+	/* If the login method is known, the last login command is held back and
+	 * sent together with the batch. With the old method, the challenge has to
+	 * be requested first. */
+	auth = host_cache_auth_get (c->host_cache, c->host_node, c->host_service);
+	c->cork = (auth != HOST_AUTH_UNKNOWN);
 
-	for (i = 0; i < 16; i++)
+	status = login_start (c);
+	if ((status == 0) && (auth == HOST_AUTH_CHALLENGE))
 	{
-		char tmp[3];
-		snprintf (tmp, 3, "%02"PRIx8, binary[i]);
-		tmp[2] = 0;
-		hex[2*i] = tmp[0];
-		hex[2*i+1] = tmp[1];
+		status = send_buffer_flush (c);
+		/* login_handler() encodes the response without sending it. */
+		while ((status == 0) && (c->state == ROS_STATE_LOGIN)
+				&& (c->send_pos == c->send_fill))
+			status = dispatch_sentence (c);
 	}
-	hex[32] = 0;
-} /* }}} void hash_binary_to_hex */
+	else if (auth == HOST_AUTH_UNKNOWN)
+	{
+		while ((status == 0) && (c->state == ROS_STATE_LOGIN))
+			status = dispatch_sentence (c);
+	}
+	c->cork = 0;
 
-static void hash_hex_to_binary (uint8_t binary[16], char hex[33]) /* {{{ */
-{
-	int i;
+	if ((status == 0) && (c->state == ROS_STATE_FAILED))
+		status = c->error;
 
-	for (i = 0; i < 16; i++)
+	encoded = 0;
+	if ((status == 0) && (entries_num > 0))
 	{
-		char tmp[3];
+		status = batch_encode (c, entries, entries_num, pending, results);
+		encoded = (status == 0);
+	}
 
-		tmp[0] = hex[2*i];
-		tmp[1] = hex[2*i + 1];
-		tmp[2] = 0;
+	if ((status == 0) && (c->send_pos < c->send_fill))
+		status = send_buffer_flush (c);
+	while ((status == 0) && (c->state == ROS_STATE_LOGIN))
+		status = dispatch_sentence (c);
 
-		binary[i] = (uint8_t) strtoul (tmp, /* endptr = */ NULL, /* base = */ 16);
+	if ((status == 0) && (c->state != ROS_STATE_READY))
+		status = c->error;
+	/* Return values of the login handlers are not of interest. */
+	c->async_status = 0;
+
+	if (status != 0)
+	{
+		batch_abort (c, entries, entries_num, encoded ? pending : NULL, status);
+		ros_disconnect (c);
+		free (pending);
+		free (results);
+		errno = status;
+		return (NULL);
 	}
-} /* }}} void hash_hex_to_binary */
 
-static void make_password_hash (char response_hex[33], /* {{{ */
-		const char *password, size_t password_length, char challenge_hex[33])
+	if (encoded)
+	{
+		deadline_set (c, c->query_timeout);
+		batch_wait (c, entries, entries_num, pending, results);
+		c->deadline = 0;
+	}
+	query_stats_update (c, &stats_start);
+
+	free (pending);
+	free (results);
+	return (c);
+} /* }}} ros_connection_t *ros_connect_batch */
+
+int ros_subscribe (ros_connection_t *c, /* {{{ */
+		const char *command,
+		size_t args_num, const char * const *args,
+		ros_reply_handler_t handler, void *user_data,
+		unsigned int *ret_tag)
 {
-	uint8_t challenge_bin[16];
-	uint8_t response_bin[16];
-	char data_buffer[password_length+17];
-	MD5_CTX md5;
+	pending_query_t *p;
 
-	hash_hex_to_binary (challenge_bin, challenge_hex);
+	if ((c == NULL) || (command == NULL) || (handler == NULL))
+		return (EINVAL);
+	if (c->state != ROS_STATE_READY)
+		return (ENOTCONN);
 
-	data_buffer[0] = 0;
-	memcpy (&data_buffer[1], password, password_length);
-	memcpy (&data_buffer[1+password_length], challenge_bin, 16);
+	p = query_start (c, command, /* prepared = */ NULL, args_num, args,
+			/* filter = */ NULL, handler, user_data,
+			/* stream = */ 1, /* result = */ NULL);
+	if (p == NULL)
+		return (errno);
+	p->subscription = 1;
 
-	MD5_Init (&md5);
-	MD5_Update (&md5, data_buffer, sizeof (data_buffer));
-	MD5_Final (response_bin, &md5);
+	if (ret_tag != NULL)
+		*ret_tag = p->tag;
 
-	hash_binary_to_hex (response_hex, response_bin);
-} /* }}} void make_password_hash */
+	return (0);
+} /* }}} int ros_subscribe */
 
-static int login_handler (ros_connection_t *c, const ros_reply_t *r, /* {{{ */
-		void *user_data)
+int ros_cancel (ros_connection_t *c, unsigned int tag) /* {{{ */
 {
-	const char *ret;
-	char challenge_hex[33];
-	char response_hex[33];
-	ros_login_data_t *login_data;
-
-	const char *params[2];
-	char param_name[1024];
-	char param_response[64];
+	pending_query_t *p;
 
-	if (r == NULL)
+	if (c == NULL)
 		return (EINVAL);
+	if (c->state != ROS_STATE_READY)
+		return (ENOTCONN);
 
-	/* The expected result looks like this:
-	 * -- 8< --
-	 *  !done 
-	 *  =ret=ebddd18303a54111e2dea05a92ab46b4
-	 * -- >8 --
-	 */
-	reply_dump (r);
+	p = pending_find (c, tag);
+	if (p == NULL)
+		return (ENOENT);
+	if (p->cancelled || p->done)
+		return (0);
 
-	if (strcmp (r->status, "done") != 0)
-	{
-		ros_debug ("login_handler: Unexpected status: %s.\n", r->status);
-		return (EPROTO);
-	}
+	return (query_cancel (c, p));
+} /* }}} int ros_cancel */
+
+int ros_query_wait (ros_connection_t *c) /* {{{ */
+{
+	int status;
 
-	login_data = user_data;
-	if (login_data == NULL)
+	if (c == NULL)
 		return (EINVAL);
+	if (c->state != ROS_STATE_READY)
+		return (ENOTCONN);
 
-	ret = ros_reply_param_val_by_key (r, "ret");
-	if (ret == NULL)
-	{
-		ros_debug ("login_handler: Reply does not have parameter \"ret\".\n");
-		return (EPROTO);
-	}
-	ros_debug ("login_handler: ret = %s;\n", ret);
+	status = send_buffer_flush (c);
+	if (status != 0)
+		return (status);
 
-	if (strlen (ret) != 32)
+	while (c->pending_head != NULL)
 	{
-		ros_debug ("login_handler: Unexpected length of the \"ret\" argument.\n");
-		return (EPROTO);
+		status = dispatch_sentence (c);
+		if (status != 0)
+			return (status);
 	}
-	strcpy (challenge_hex, ret);
 
-	make_password_hash (response_hex, 
-			login_data->password, strlen (login_data->password),
-			challenge_hex);
-
-	snprintf (param_name, sizeof (param_name), "=name=%s", login_data->username);
-	snprintf (param_response, sizeof (param_response),
-			"=response=00%s", response_hex);
-	params[0] = param_name;
-	params[1] = param_response;
+	status = c->async_status;
+	c->async_status = 0;
 
-	return (ros_query (c, "/login", 2, params, login2_handler,
-				/* user data = */ NULL));
-} /* }}} int login_handler */
+	return (status);
+} /* }}} int ros_query_wait */
 
-/*
- * Public functions
- */
-ros_connection_t *ros_connect (const char *node, const char *service, /* {{{ */
-		const char *username, const char *password)
+int ros_query_pending (const ros_connection_t *c) /* {{{ */
 {
-	return ros_connect_with_options(node, service, username, password, NULL);
-} /* }}} ros_connection_t *ros_connect */
+	pending_query_t *p;
+	int num;
 
-ros_connection_t *ros_connect_with_options (const char *node, const char *service, /* {{{ */
-		const char *username, const char *password, const ros_connect_opts_t *connect_opts)
-{
-	int fd;
-	ros_connection_t *c;
-	int status;
-	ros_login_data_t user_data;
+	if (c == NULL)
+		return (0);
 
-	const char *params[2];
-	char param_username[1024];
-	char param_password[1024];
+	num = 0;
+	for (p = c->pending_head; p != NULL; p = p->next)
+		num++;
 
-	if ((node == NULL) || (username == NULL) || (password == NULL))
-		return (NULL);
+	return (num);
+} /* }}} int ros_query_pending */
 
-	fd = create_socket (node, (service != NULL) ? service : ROUTEROS_API_PORT, connect_opts);
-	if (fd < 0)
-		return (NULL);
+ros_prepared_t *ros_prepare (const char *command, /* {{{ */
+		size_t args_num, const char * const *args)
+{
+	ros_prepared_t *p;
+	size_t i;
+	int status;
 
-	c = malloc (sizeof (*c));
-	if (c == NULL)
+	if ((command == NULL) || ((args == NULL) && (args_num > 0)))
 	{
-		close (fd);
+		errno = EINVAL;
 		return (NULL);
 	}
-	memset (c, 0, sizeof (*c));
-
-	c->fd = fd;
 
-	user_data.username = username;
-	user_data.password = password;
+	p = malloc (sizeof (*p));
+	if (p == NULL)
+		return (NULL);
+	memset (p, 0, sizeof (*p));
 
-	/* first we are trying to login using new post-v6.43 method
-		with username and password filled in */
-	snprintf (param_username, sizeof (param_username), "=name=%s", username);
-	snprintf (param_password, sizeof (param_password), "=password=%s", password);
-	params[0] = param_username;
-	params[1] = param_password;
-	status = ros_query (c, "/login", 2, params, login2_handler, &user_data);
+	status = encoded_words_add (&p->words, command, strlen (command));
+	for (i = 0; (status == 0) && (i < args_num); i++)
+	{
+		if (args[i] == NULL)
+			status = EINVAL;
+		else
+			status = encoded_words_add (&p->words, args[i], strlen (args[i]));
+	}
 
 	if (status != 0)
 	{
-		ros_disconnect (c);
+		ros_prepared_destroy (p);
 		errno = status;
 		return (NULL);
 	}
 
-	return (c);
-} /* }}} ros_connection_t *ros_connect_with_options */
+	return (p);
+} /* }}} ros_prepared_t *ros_prepare */
 
-int ros_disconnect (ros_connection_t *c) /* {{{ */
+void ros_prepared_destroy (ros_prepared_t *p) /* {{{ */
 {
-	if (c == NULL)
-		return (EINVAL);
+	if (p == NULL)
+		return;
 
-	if (c->fd >= 0)
-	{
-		close (c->fd);
-		c->fd = -1;
-	}
+	free (p->words.data);
+	free (p);
+} /* }}} void ros_prepared_destroy */
 
-	free (c);
+int ros_query_prepared (ros_connection_t *c, /* {{{ */
+		const ros_prepared_t *prepared,
+		size_t args_num, const char * const *args,
+		ros_reply_handler_t handler, void *user_data)
+{
+	if ((c == NULL) || (prepared == NULL) || (handler == NULL))
+		return (EINVAL);
 
-	return (0);
-} /* }}} int ros_disconnect */
+	return (query_run (c, /* command = */ NULL, prepared, args_num, args,
+				/* opts = */ NULL, handler, user_data, /* stream = */ 0));
+} /* }}} int ros_query_prepared */
 
-int ros_query (ros_connection_t *c, /* {{{ */
-		const char *command,
+int ros_query_prepared_start (ros_connection_t *c, /* {{{ */
+		const ros_prepared_t *prepared,
 		size_t args_num, const char * const *args,
 		ros_reply_handler_t handler, void *user_data)
 {
+	if ((c == NULL) || (prepared == NULL) || (handler == NULL))
+		return (EINVAL);
+	if (c->state != ROS_STATE_READY)
+		return (ENOTCONN);
+
+	if (query_start (c, /* command = */ NULL, prepared, args_num, args,
+				/* filter = */ NULL, handler, user_data,
+				/* stream = */ 0, /* result = */ NULL) == NULL)
+		return (errno);
+
+	return (0);
+} /* }}} int ros_query_prepared_start */
+
+ros_filter_t *ros_filter_create (void) /* {{{ */
+{
+	ros_filter_t *f;
+
+	f = malloc (sizeof (*f));
+	if (f == NULL)
+		return (NULL);
+	memset (f, 0, sizeof (*f));
+
+	return (f);
+} /* }}} ros_filter_t *ros_filter_create */
+
+void ros_filter_destroy (ros_filter_t *f) /* {{{ */
+{
+	if (f == NULL)
+		return;
+
+	free (f->words.data);
+	free (f);
+} /* }}} void ros_filter_destroy */
+
+int ros_filter_equal (ros_filter_t *f, /* {{{ */
+		const char *key, const char *value)
+{
+	return (filter_add (f, "?", key, value));
+} /* }}} int ros_filter_equal */
+
+int ros_filter_less (ros_filter_t *f, /* {{{ */
+		const char *key, const char *value)
+{
+	return (filter_add (f, "?<", key, value));
+} /* }}} int ros_filter_less */
+
+int ros_filter_greater (ros_filter_t *f, /* {{{ */
+		const char *key, const char *value)
+{
+	return (filter_add (f, "?>", key, value));
+} /* }}} int ros_filter_greater */
+
+int ros_filter_has (ros_filter_t *f, const char *key) /* {{{ */
+{
+	return (filter_add (f, "?", key, /* value = */ NULL));
+} /* }}} int ros_filter_has */
+
+int ros_filter_has_not (ros_filter_t *f, const char *key) /* {{{ */
+{
+	return (filter_add (f, "?-", key, /* value = */ NULL));
+} /* }}} int ros_filter_has_not */
+
+int ros_filter_operations (ros_filter_t *f, const char *ops) /* {{{ */
+{
+	size_t depth;
+	size_t i;
 	int status;
-	ros_reply_t *r;
 
-	if ((c == NULL) || (command == NULL) || (handler == NULL))
+	if ((f == NULL) || (ops == NULL) || (ops[0] == 0))
 		return (EINVAL);
 
-	status = send_command (c, command, args_num, args);
-	if (status != 0)
-		return (status);
+	depth = f->depth;
+	for (i = 0; ops[i] != 0; i++)
+	{
+		switch (ops[i])
+		{
+			case '|':
+			case '&':
+				if (depth < 2)
+					return (EINVAL);
+				depth--;
+				break;
 
-	r = receive_reply (c);
-	if (r == NULL)
-		return (EPROTO);
+			case '!':
+				if (depth < 1)
+					return (EINVAL);
+				break;
+
+			case '.':
+				if (depth < 1)
+					return (EINVAL);
+				depth++;
+				break;
 
-	/* Call the callback function with the data we received. */
-	status = (*handler) (c, r, user_data);
+			default:
+				return (EINVAL);
+		}
+	}
 
-	/* Free the allocated memory ... */
-	reply_free (r);
+	status = filter_add (f, "?#", ops, /* value = */ NULL);
+	if (status != 0)
+		return (status);
 
-	/* ... and return. */
-	return (status);
-} /* }}} int ros_query */
+	/* filter_add counted the word as one more result. */
+	f->depth = depth;
+	return (0);
+} /* }}} int ros_filter_operations */
 
 const ros_reply_t *ros_reply_next (const ros_reply_t *r) /* {{{ */
 {
@@ -1048,6 +3706,21 @@ const char *ros_reply_param_val_by_key (const ros_reply_t *r, /* {{{ */
 	if ((r == NULL) || (key == NULL))
 		return (NULL);
 
+	if (r->index != NULL)
+	{
+		unsigned int slot = fnv1a (FNV1A_INIT, key) & (r->index_size - 1);
+
+		while (r->index[slot] != 0)
+		{
+			i = r->index[slot] - 1;
+			if (strcmp (r->keys[i], key) == 0)
+				return (r->values[i]);
+			slot = (slot + 1) & (r->index_size - 1);
+		}
+
+		return (NULL);
+	}
+
 	for (i = 0; i < r->params_num; i++)
 		if (strcmp (r->keys[i], key) == 0)
 			return (r->values[i]);
@@ -1055,6 +3728,26 @@ const char *ros_reply_param_val_by_key (const ros_reply_t *r, /* {{{ */
 	return (NULL);
 } /* }}} char *ros_reply_param_val_by_key */
 
+int ros_connection_stats (const ros_connection_t *c, /* {{{ */
+		ros_query_stats_t *ret)
+{
+	if ((c == NULL) || (ret == NULL))
+		return (EINVAL);
+
+	*ret = c->stats;
+	return (0);
+} /* }}} int ros_connection_stats */
+
+int ros_query_stats (const ros_connection_t *c, /* {{{ */
+		ros_query_stats_t *ret)
+{
+	if ((c == NULL) || (ret == NULL))
+		return (EINVAL);
+
+	*ret = c->query_stats;
+	return (0);
+} /* }}} int ros_query_stats */
+
 int ros_version (void) /* {{{ */
 {
 	return (ROS_VERSION);
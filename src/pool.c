@@ -0,0 +1,475 @@
+/**
+ * librouteros - src/pool.c
+ * Copyright (C) 2026  agent
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+ * OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ *
+ * Authors:
+ *   agent <agent at local>
+ **/
+
+#ifndef _ISOC99_SOURCE
+# define _ISOC99_SOURCE
+#endif
+
+#ifndef _POSIX_C_SOURCE
+# define _POSIX_C_SOURCE 200112L
+#endif
+
+#include "config.h"
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+
+#include "routeros_api.h"
+#include "ros_util.h"
+
+/* Used to check idle connections: cheap and available on all versions. */
+#define ROS_POOL_PROBE_COMMAND "/system/identity/print"
+/* Time in seconds the probe may take. A peer that vanished without a reset
+ * would otherwise block the probe until the kernel gives up on the socket. */
+#define ROS_POOL_PROBE_TIMEOUT 5
+
+/*
+ * Private data types
+ */
+struct pool_host_s;
+typedef struct pool_host_s pool_host_t;
+
+struct pool_conn_s;
+typedef struct pool_conn_s pool_conn_t;
+struct pool_conn_s
+{
+	ros_connection_t *connection;
+	pool_host_t *host;
+	/* Time the connection was last known to work. */
+	uint64_t last_used;
+
+	pool_conn_t *next;
+};
+
+struct pool_host_s
+{
+	char *node;
+	char *service;
+	char *username;
+	char *password;
+
+	/* Idle connections, most recently used first. */
+	pool_conn_t *idle;
+	unsigned int idle_num;
+
+	pool_host_t *next;
+};
+
+struct ros_pool_s
+{
+	ros_connect_opts_t connect_opts;
+	unsigned int probe_interval;
+	unsigned int max_idle;
+
+	pthread_mutex_t lock;
+	pool_host_t *hosts;
+	/* Connections handed out by ros_pool_get. */
+	pool_conn_t *lent;
+};
+
+/*
+ * Private functions
+ */
+static void pool_strfree (char *s) /* {{{ */
+{
+	if (s == NULL)
+		return;
+
+	/* May contain a password. */
+	memset (s, 0, strlen (s));
+	free (s);
+} /* }}} void pool_strfree */
+
+static void pool_host_free (pool_host_t *h) /* {{{ */
+{
+	if (h == NULL)
+		return;
+
+	free (h->node);
+	free (h->service);
+	pool_strfree (h->username);
+	pool_strfree (h->password);
+	free (h);
+} /* }}} void pool_host_free */
+
+/* Looks up the host entry for the given arguments, creating it if necessary.
+ * Must be called with the pool locked. */
+static pool_host_t *pool_host_get (ros_pool_t *p, /* {{{ */
+		const char *node, const char *service,
+		const char *username, const char *password)
+{
+	pool_host_t *h;
+
+	for (h = p->hosts; h != NULL; h = h->next)
+	{
+		if ((strcmp (h->node, node) == 0)
+				&& (strcmp (h->service, service) == 0)
+				&& (strcmp (h->username, username) == 0)
+				&& (strcmp (h->password, password) == 0))
+			return (h);
+	}
+
+	h = malloc (sizeof (*h));
+	if (h == NULL)
+		return (NULL);
+	memset (h, 0, sizeof (*h));
+
+	h->node = sstrdup (node);
+	h->service = sstrdup (service);
+	h->username = sstrdup (username);
+	h->password = sstrdup (password);
+	if ((h->node == NULL) || (h->service == NULL)
+			|| (h->username == NULL) || (h->password == NULL))
+	{
+		pool_host_free (h);
+		return (NULL);
+	}
+
+	h->next = p->hosts;
+	p->hosts = h;
+
+	return (h);
+} /* }}} pool_host_t *pool_host_get */
+
+/* Must be called with the pool locked. */
+static pool_conn_t *pool_idle_pop (pool_host_t *h) /* {{{ */
+{
+	pool_conn_t *pc;
+
+	pc = h->idle;
+	if (pc == NULL)
+		return (NULL);
+
+	h->idle = pc->next;
+	h->idle_num--;
+	pc->next = NULL;
+
+	return (pc);
+} /* }}} pool_conn_t *pool_idle_pop */
+
+/* Adds a connection to the idle list of its host. Connections exceeding the
+ * limit are closed. Must be called with the pool locked. */
+static void pool_idle_push (ros_pool_t *p, pool_conn_t *pc) /* {{{ */
+{
+	pool_host_t *h = pc->host;
+
+	if ((p->max_idle != 0) && (h->idle_num >= p->max_idle))
+	{
+		ros_disconnect (pc->connection);
+		free (pc);
+		return;
+	}
+
+	pc->next = h->idle;
+	h->idle = pc;
+	h->idle_num++;
+} /* }}} void pool_idle_push */
+
+static int pool_probe_handler (__attribute__((unused)) ros_connection_t *c, /* {{{ */
+		const ros_reply_t *r,
+		__attribute__((unused)) void *user_data)
+{
+	if (r == NULL)
+		return (EPROTO);
+
+	while (ros_reply_next (r) != NULL)
+		r = ros_reply_next (r);
+
+	if (strcmp ("done", ros_reply_status (r)) != 0)
+		return (EPROTO);
+
+	return (0);
+} /* }}} int pool_probe_handler */
+
+/* Checks whether an idle connection still works. Called without the lock
+ * held. */
+static _Bool pool_probe (ros_pool_t *p, pool_conn_t *pc) /* {{{ */
+{
+	ros_query_options_t opts;
+	uint64_t now = clock_now_s ();
+
+	if ((now - pc->last_used) < ((uint64_t) p->probe_interval))
+		return (1);
+
+	memset (&opts, 0, sizeof (opts));
+	opts.timeout = ROS_POOL_PROBE_TIMEOUT;
+
+	/* Any failure, including ETIMEDOUT, means the connection is dead. */
+	if (ros_query_with_options (pc->connection, ROS_POOL_PROBE_COMMAND,
+				/* args_num = */ 0, /* args = */ NULL,
+				pool_probe_handler, /* user data = */ NULL, &opts) != 0)
+		return (0);
+
+	pc->last_used = now;
+	return (1);
+} /* }}} _Bool pool_probe */
+
+/* Opens a new connection to "h". Called without the lock held; the host entry
+ * is never freed while the pool exists. */
+static pool_conn_t *pool_connect (ros_pool_t *p, pool_host_t *h) /* {{{ */
+{
+	pool_conn_t *pc;
+
+	pc = malloc (sizeof (*pc));
+	if (pc == NULL)
+	{
+		errno = ENOMEM;
+		return (NULL);
+	}
+	memset (pc, 0, sizeof (*pc));
+
+	pc->connection = ros_connect_with_options (h->node, h->service,
+			h->username, h->password, &p->connect_opts);
+	if (pc->connection == NULL)
+	{
+		int status = errno;
+		free (pc);
+		errno = status;
+		return (NULL);
+	}
+
+	pc->host = h;
+	pc->last_used = clock_now_s ();
+
+	return (pc);
+} /* }}} pool_conn_t *pool_connect */
+
+/*
+ * Public functions
+ */
+ros_pool_t *ros_pool_create (const ros_connect_opts_t *connect_opts, /* {{{ */
+		unsigned int probe_interval, unsigned int max_idle)
+{
+	ros_pool_t *p;
+
+	p = malloc (sizeof (*p));
+	if (p == NULL)
+		return (NULL);
+	memset (p, 0, sizeof (*p));
+
+	if (connect_opts != NULL)
+		p->connect_opts = *connect_opts;
+	p->probe_interval = probe_interval;
+	p->max_idle = max_idle;
+
+	if (pthread_mutex_init (&p->lock, /* attr = */ NULL) != 0)
+	{
+		free (p);
+		return (NULL);
+	}
+
+	return (p);
+} /* }}} ros_pool_t *ros_pool_create */
+
+ros_connection_t *ros_pool_get (ros_pool_t *p, /* {{{ */
+		const char *node, const char *service,
+		const char *username, const char *password)
+{
+	pool_host_t *h;
+	pool_conn_t *pc;
+
+	if ((p == NULL) || (node == NULL) || (username == NULL)
+			|| (password == NULL))
+	{
+		errno = EINVAL;
+		return (NULL);
+	}
+
+	if (service == NULL)
+		service = ROUTEROS_API_PORT;
+
+	pthread_mutex_lock (&p->lock);
+	h = pool_host_get (p, node, service, username, password);
+	if (h == NULL)
+	{
+		pthread_mutex_unlock (&p->lock);
+		errno = ENOMEM;
+		return (NULL);
+	}
+
+	/* Use the most recently used connection that still works. */
+	while ((pc = pool_idle_pop (h)) != NULL)
+	{
+		_Bool ok;
+
+		pthread_mutex_unlock (&p->lock);
+		ok = pool_probe (p, pc);
+		if (!ok)
+		{
+			ros_disconnect (pc->connection);
+			free (pc);
+		}
+		pthread_mutex_lock (&p->lock);
+
+		if (ok)
+			break;
+	}
+	pthread_mutex_unlock (&p->lock);
+
+	if (pc == NULL)
+	{
+		pc = pool_connect (p, h);
+		if (pc == NULL)
+			return (NULL);
+	}
+
+	pthread_mutex_lock (&p->lock);
+	pc->next = p->lent;
+	p->lent = pc;
+	pthread_mutex_unlock (&p->lock);
+
+	return (pc->connection);
+} /* }}} ros_connection_t *ros_pool_get */
+
+int ros_pool_put (ros_pool_t *p, ros_connection_t *c) /* {{{ */
+{
+	pool_conn_t **pc_ptr;
+	pool_conn_t *pc;
+
+	if ((p == NULL) || (c == NULL))
+		return (EINVAL);
+
+	pthread_mutex_lock (&p->lock);
+	for (pc_ptr = &p->lent; *pc_ptr != NULL; pc_ptr = &(*pc_ptr)->next)
+		if ((*pc_ptr)->connection == c)
+			break;
+
+	pc = *pc_ptr;
+	if (pc == NULL)
+	{
+		pthread_mutex_unlock (&p->lock);
+		return (ENOENT);
+	}
+	*pc_ptr = pc->next;
+	pc->next = NULL;
+
+	/* Connections that failed or are waiting for a reply cannot be re-used. */
+	if ((ros_connection_state (c) != ROS_STATE_READY)
+			|| (ros_query_pending (c) != 0))
+	{
+		pthread_mutex_unlock (&p->lock);
+		ros_disconnect (c);
+		free (pc);
+		return (0);
+	}
+
+	pc->last_used = clock_now_s ();
+	pool_idle_push (p, pc);
+	pthread_mutex_unlock (&p->lock);
+
+	return (0);
+} /* }}} int ros_pool_put */
+
+int ros_pool_maintain (ros_pool_t *p) /* {{{ */
+{
+	pool_host_t *h;
+
+	if (p == NULL)
+		return (EINVAL);
+
+	pthread_mutex_lock (&p->lock);
+	for (h = p->hosts; h != NULL; h = h->next)
+	{
+		pool_conn_t *checked = NULL;
+		unsigned int dead_num = 0;
+		pool_conn_t *pc;
+
+		/* Probe all idle connections of the host. Connections returned by
+		 * ros_pool_put in the meantime have just been used and are not probed. */
+		while ((pc = pool_idle_pop (h)) != NULL)
+		{
+			pthread_mutex_unlock (&p->lock);
+			if (!pool_probe (p, pc))
+			{
+				ros_disconnect (pc->connection);
+				free (pc);
+				pc = NULL;
+				dead_num++;
+			}
+			pthread_mutex_lock (&p->lock);
+
+			if (pc != NULL)
+			{
+				pc->next = checked;
+				checked = pc;
+			}
+		}
+
+		while (checked != NULL)
+		{
+			pc = checked;
+			checked = pc->next;
+			pool_idle_push (p, pc);
+		}
+
+		/* Replace dead connections so that callers don't have to wait. */
+		for (; dead_num > 0; dead_num--)
+		{
+			pthread_mutex_unlock (&p->lock);
+			pc = pool_connect (p, h);
+			pthread_mutex_lock (&p->lock);
+
+			if (pc == NULL)
+				break;
+			pool_idle_push (p, pc);
+		}
+	}
+	pthread_mutex_unlock (&p->lock);
+
+	return (0);
+} /* }}} int ros_pool_maintain */
+
+int ros_pool_destroy (ros_pool_t *p) /* {{{ */
+{
+	pool_host_t *h;
+	pool_conn_t *pc;
+
+	if (p == NULL)
+		return (EINVAL);
+
+	while ((h = p->hosts) != NULL)
+	{
+		p->hosts = h->next;
+
+		while ((pc = pool_idle_pop (h)) != NULL)
+		{
+			ros_disconnect (pc->connection);
+			free (pc);
+		}
+		pool_host_free (h);
+	}
+
+	/* Connections still in use belong to the callers now. */
+	while ((pc = p->lent) != NULL)
+	{
+		p->lent = pc->next;
+		free (pc);
+	}
+
+	pthread_mutex_destroy (&p->lock);
+	free (p);
+
+	return (0);
+} /* }}} int ros_pool_destroy */
+
+/* vim: set ts=2 sw=2 noet fdm=marker : */
@@ -0,0 +1,430 @@
+/**
+ * librouteros - src/rate.c
+ * Copyright (C) 2026  agent
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+ * OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ *
+ * Authors:
+ *   agent <agent at local>
+ **/
+
+#ifndef _ISOC99_SOURCE
+# define _ISOC99_SOURCE
+#endif
+
+#ifndef _POSIX_C_SOURCE
+# define _POSIX_C_SOURCE 200112L
+#endif
+
+#include "config.h"
+
+#include <stdlib.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+
+#include "routeros_api.h"
+#include "ros_util.h"
+
+#define RATE_COUNTERS_MAX 12
+#define RATE_TABLE_SIZE_MIN 16
+
+#define RATE_TYPE_INTERFACE          1
+#define RATE_TYPE_REGISTRATION_TABLE 2
+
+/*
+ * Private data types
+ */
+struct rate_entry_s;
+typedef struct rate_entry_s rate_entry_t;
+struct rate_entry_s
+{
+	char *key;
+	uint32_t hash;
+	int type;
+
+	uint64_t counters[RATE_COUNTERS_MAX];
+	size_t counters_num;
+	uint64_t time; /* nanoseconds, monotonic */
+
+	rate_entry_t *next;
+};
+
+struct ros_rate_tracker_s
+{
+	rate_entry_t **table;
+	size_t table_size;
+	size_t entries_num;
+
+	/* Width of the device's counters, 32 or 64. */
+	unsigned int counter_bits;
+};
+
+/* Counters of ros_interface_t and the corresponding fields of
+ * ros_interface_rate_t, in the same order. */
+static const size_t if_counters[] =
+{
+	offsetof (ros_interface_t, rx_packets),
+	offsetof (ros_interface_t, tx_packets),
+	offsetof (ros_interface_t, rx_bytes),
+	offsetof (ros_interface_t, tx_bytes),
+	offsetof (ros_interface_t, rx_errors),
+	offsetof (ros_interface_t, tx_errors),
+	offsetof (ros_interface_t, rx_drops),
+	offsetof (ros_interface_t, tx_drops)
+};
+
+static const size_t if_rates[] =
+{
+	offsetof (ros_interface_rate_t, rx_packets),
+	offsetof (ros_interface_rate_t, tx_packets),
+	offsetof (ros_interface_rate_t, rx_bytes),
+	offsetof (ros_interface_rate_t, tx_bytes),
+	offsetof (ros_interface_rate_t, rx_errors),
+	offsetof (ros_interface_rate_t, tx_errors),
+	offsetof (ros_interface_rate_t, rx_drops),
+	offsetof (ros_interface_rate_t, tx_drops)
+};
+
+static const size_t rt_counters[] =
+{
+	offsetof (ros_registration_table_t, rx_packets),
+	offsetof (ros_registration_table_t, tx_packets),
+	offsetof (ros_registration_table_t, rx_bytes),
+	offsetof (ros_registration_table_t, tx_bytes),
+	offsetof (ros_registration_table_t, rx_frames),
+	offsetof (ros_registration_table_t, tx_frames),
+	offsetof (ros_registration_table_t, rx_frame_bytes),
+	offsetof (ros_registration_table_t, tx_frame_bytes),
+	offsetof (ros_registration_table_t, rx_hw_frames),
+	offsetof (ros_registration_table_t, tx_hw_frames),
+	offsetof (ros_registration_table_t, rx_hw_frame_bytes),
+	offsetof (ros_registration_table_t, tx_hw_frame_bytes)
+};
+
+static const size_t rt_rates[] =
+{
+	offsetof (ros_registration_table_rate_t, rx_packets),
+	offsetof (ros_registration_table_rate_t, tx_packets),
+	offsetof (ros_registration_table_rate_t, rx_bytes),
+	offsetof (ros_registration_table_rate_t, tx_bytes),
+	offsetof (ros_registration_table_rate_t, rx_frames),
+	offsetof (ros_registration_table_rate_t, tx_frames),
+	offsetof (ros_registration_table_rate_t, rx_frame_bytes),
+	offsetof (ros_registration_table_rate_t, tx_frame_bytes),
+	offsetof (ros_registration_table_rate_t, rx_hw_frames),
+	offsetof (ros_registration_table_rate_t, tx_hw_frames),
+	offsetof (ros_registration_table_rate_t, rx_hw_frame_bytes),
+	offsetof (ros_registration_table_rate_t, tx_hw_frame_bytes)
+};
+
+/*
+ * Private functions
+ */
+/* Computes the increase from "prev" to "cur". If the counter went backwards,
+ * this is either a wrap-around or a reset. 64 bit counters don't wrap in
+ * practice, so for them this is always a reset. 32 bit counters are assumed
+ * to have wrapped at 2^32, unless the resulting increase is more than half
+ * the counter's range. Returns -1 for a reset. */
+static int rate_counter_delta (uint64_t prev, uint64_t cur, /* {{{ */
+		unsigned int counter_bits, uint64_t *ret)
+{
+	uint64_t delta;
+
+	if (cur >= prev)
+	{
+		*ret = cur - prev;
+		return (0);
+	}
+
+	if ((counter_bits != 32) || (prev > UINT32_MAX))
+		return (-1);
+
+	delta = (((uint64_t) UINT32_MAX) - prev) + cur + 1;
+	if (delta > (((uint64_t) UINT32_MAX) / 2))
+		return (-1);
+
+	*ret = delta;
+	return (0);
+} /* }}} int rate_counter_delta */
+
+static int rate_table_grow (ros_rate_tracker_t *t) /* {{{ */
+{
+	rate_entry_t **table;
+	size_t size;
+	size_t i;
+
+	size = 2 * t->table_size;
+	if (size < RATE_TABLE_SIZE_MIN)
+		size = RATE_TABLE_SIZE_MIN;
+
+	table = calloc (size, sizeof (*table));
+	if (table == NULL)
+		return (ENOMEM);
+
+	for (i = 0; i < t->table_size; i++)
+	{
+		rate_entry_t *e;
+		rate_entry_t *next;
+
+		for (e = t->table[i]; e != NULL; e = next)
+		{
+			next = e->next;
+			e->next = table[e->hash & (size - 1)];
+			table[e->hash & (size - 1)] = e;
+		}
+	}
+
+	free (t->table);
+	t->table = table;
+	t->table_size = size;
+
+	return (0);
+} /* }}} int rate_table_grow */
+
+static rate_entry_t *rate_entry_get (ros_rate_tracker_t *t, /* {{{ */
+		int type, const char *key, _Bool *ret_created)
+{
+	rate_entry_t *e;
+	uint32_t hash;
+
+	*ret_created = 0;
+	hash = fnv1a (FNV1A_INIT, key);
+
+	if (t->table_size > 0)
+	{
+		for (e = t->table[hash & (t->table_size - 1)]; e != NULL; e = e->next)
+			if ((e->hash == hash) && (e->type == type)
+					&& (strcmp (e->key, key) == 0))
+				return (e);
+	}
+
+	if (t->entries_num >= t->table_size)
+		if (rate_table_grow (t) != 0)
+			return (NULL);
+
+	e = calloc (1, sizeof (*e));
+	if (e == NULL)
+		return (NULL);
+
+	e->key = sstrdup (key);
+	if (e->key == NULL)
+	{
+		free (e);
+		return (NULL);
+	}
+	e->hash = hash;
+	e->type = type;
+
+	e->next = t->table[hash & (t->table_size - 1)];
+	t->table[hash & (t->table_size - 1)] = e;
+	t->entries_num++;
+
+	*ret_created = 1;
+	return (e);
+} /* }}} rate_entry_t *rate_entry_get */
+
+/* Stores a new sample for "key" and computes the per-second rates relative to
+ * the previous one. Returns true if "rates" is valid. */
+static _Bool rate_update (ros_rate_tracker_t *t, /* {{{ */
+		int type, const char *key, uint64_t now,
+		const void *sample, const size_t *counters,
+		void *ret_rate, const size_t *rates, size_t num,
+		double *ret_interval)
+{
+	rate_entry_t *e;
+	_Bool created;
+	_Bool valid;
+	double interval;
+	size_t i;
+
+	*ret_interval = 0.0;
+
+	if (key == NULL)
+		return (0);
+
+	e = rate_entry_get (t, type, key, &created);
+	if (e == NULL)
+		return (0);
+
+	/* Two samples with the same timestamp: keep the older one. */
+	if (!created && (now <= e->time))
+		return (0);
+
+	valid = !created && (e->counters_num == num);
+	interval = ((double) (now - e->time)) / 1000000000.0;
+
+	for (i = 0; i < num; i++)
+	{
+		uint64_t cur = *((const uint64_t *) (((const char *) sample) + counters[i]));
+		uint64_t delta;
+
+		if (valid)
+		{
+			if (rate_counter_delta (e->counters[i], cur,
+					t->counter_bits, &delta) == 0)
+				*((double *) (((char *) ret_rate) + rates[i])) = ((double) delta) / interval;
+			else
+				valid = 0;
+		}
+
+		e->counters[i] = cur;
+	}
+	e->counters_num = num;
+	e->time = now;
+
+	if (valid)
+		*ret_interval = interval;
+	return (valid);
+} /* }}} _Bool rate_update */
+
+/*
+ * Public functions
+ */
+ros_rate_tracker_t *ros_rate_tracker_create (unsigned int counter_bits) /* {{{ */
+{
+	ros_rate_tracker_t *t;
+
+	if ((counter_bits != 32) && (counter_bits != 64))
+	{
+		errno = EINVAL;
+		return (NULL);
+	}
+
+	t = malloc (sizeof (*t));
+	if (t == NULL)
+		return (NULL);
+	memset (t, 0, sizeof (*t));
+	t->counter_bits = counter_bits;
+
+	return (t);
+} /* }}} ros_rate_tracker_t *ros_rate_tracker_create */
+
+void ros_rate_tracker_purge (ros_rate_tracker_t *t, /* {{{ */
+		unsigned int max_age)
+{
+	uint64_t now;
+	uint64_t max_age_ns;
+	size_t i;
+
+	if (t == NULL)
+		return;
+
+	now = clock_now_ns ();
+	max_age_ns = ((uint64_t) max_age) * 1000000000;
+
+	for (i = 0; i < t->table_size; i++)
+	{
+		rate_entry_t **ptr = t->table + i;
+
+		while (*ptr != NULL)
+		{
+			rate_entry_t *e = *ptr;
+
+			if ((now - e->time) <= max_age_ns)
+			{
+				ptr = &e->next;
+				continue;
+			}
+
+			*ptr = e->next;
+			free (e->key);
+			free (e);
+			t->entries_num--;
+		}
+	}
+} /* }}} void ros_rate_tracker_purge */
+
+void ros_rate_tracker_destroy (ros_rate_tracker_t *t) /* {{{ */
+{
+	size_t i;
+
+	if (t == NULL)
+		return;
+
+	for (i = 0; i < t->table_size; i++)
+	{
+		rate_entry_t *e;
+		rate_entry_t *next;
+
+		for (e = t->table[i]; e != NULL; e = next)
+		{
+			next = e->next;
+			free (e->key);
+			free (e);
+		}
+	}
+
+	free (t->table);
+	free (t);
+} /* }}} void ros_rate_tracker_destroy */
+
+int ros_rate_interface (ros_rate_tracker_t *t, /* {{{ */
+		const ros_interface_t *i, size_t i_num, ros_interface_rate_t *ret)
+{
+	uint64_t now;
+	size_t n;
+
+	if ((t == NULL) || ((i_num > 0) && ((i == NULL) || (ret == NULL))))
+		return (EINVAL);
+
+	now = clock_now_ns ();
+	if (now == 0)
+		return (errno);
+
+	for (n = 0; n < i_num; n++)
+	{
+		memset (ret + n, 0, sizeof (ret[n]));
+		ret[n].valid = rate_update (t, RATE_TYPE_INTERFACE, i[n].name, now,
+				i + n, if_counters, ret + n, if_rates,
+				sizeof (if_counters) / sizeof (if_counters[0]),
+				&ret[n].interval);
+		if (!ret[n].valid)
+			memset (ret + n, 0, sizeof (ret[n]));
+	}
+
+	return (0);
+} /* }}} int ros_rate_interface */
+
+int ros_rate_registration_table (ros_rate_tracker_t *t, /* {{{ */
+		const ros_registration_table_t *r, size_t r_num,
+		ros_registration_table_rate_t *ret)
+{
+	uint64_t now;
+	size_t n;
+
+	if ((t == NULL) || ((r_num > 0) && ((r == NULL) || (ret == NULL))))
+		return (EINVAL);
+
+	now = clock_now_ns ();
+	if (now == 0)
+		return (errno);
+
+	for (n = 0; n < r_num; n++)
+	{
+		memset (ret + n, 0, sizeof (ret[n]));
+		ret[n].valid = rate_update (t, RATE_TYPE_REGISTRATION_TABLE,
+				r[n].mac_address, now,
+				r + n, rt_counters, ret + n, rt_rates,
+				sizeof (rt_counters) / sizeof (rt_counters[0]),
+				&ret[n].interval);
+		if (!ret[n].valid)
+			memset (ret + n, 0, sizeof (ret[n]));
+	}
+
+	return (0);
+} /* }}} int ros_rate_registration_table */
+
+/* vim: set ts=2 sw=2 noet fdm=marker : */
@@ -29,6 +29,7 @@
 #include "config.h"
 
 #include <stdlib.h>
+#include <stddef.h>
 #include <math.h>
 #include <errno.h>
 #include <string.h>
@@ -91,96 +92,179 @@ struct rt_internal_data_s
 };
 typedef struct rt_internal_data_s rt_internal_data_t;
 
+struct rt_array_internal_data_s
+{
+	ros_registration_table_array_handler_t handler;
+	void *user_data;
+};
+typedef struct rt_array_internal_data_s rt_array_internal_data_t;
+
+/* Sorted by key. */
+static const schema_field_t rt_fields[] =
+{
+	SCHEMA_FIELD ("ap", SCHEMA_BOOL, ros_registration_table_t, ap,
+			ROS_REGISTRATION_TABLE_FIELD_AP),
+	SCHEMA_FIELD_RX_TX ("bytes", ros_registration_table_t, rx_bytes, tx_bytes,
+			ROS_REGISTRATION_TABLE_FIELD_RX_BYTES
+			| ROS_REGISTRATION_TABLE_FIELD_TX_BYTES),
+	SCHEMA_FIELD_RX_TX ("frame-bytes", ros_registration_table_t,
+			rx_frame_bytes, tx_frame_bytes,
+			ROS_REGISTRATION_TABLE_FIELD_RX_FRAME_BYTES
+			| ROS_REGISTRATION_TABLE_FIELD_TX_FRAME_BYTES),
+	SCHEMA_FIELD_RX_TX ("frames", ros_registration_table_t, rx_frames, tx_frames,
+			ROS_REGISTRATION_TABLE_FIELD_RX_FRAMES
+			| ROS_REGISTRATION_TABLE_FIELD_TX_FRAMES),
+	SCHEMA_FIELD_RX_TX ("hw-frame-bytes", ros_registration_table_t,
+			rx_hw_frame_bytes, tx_hw_frame_bytes,
+			ROS_REGISTRATION_TABLE_FIELD_RX_HW_FRAME_BYTES
+			| ROS_REGISTRATION_TABLE_FIELD_TX_HW_FRAME_BYTES),
+	SCHEMA_FIELD_RX_TX ("hw-frames", ros_registration_table_t,
+			rx_hw_frames, tx_hw_frames,
+			ROS_REGISTRATION_TABLE_FIELD_RX_HW_FRAMES
+			| ROS_REGISTRATION_TABLE_FIELD_TX_HW_FRAMES),
+	SCHEMA_FIELD ("interface", SCHEMA_STRING, ros_registration_table_t, interface,
+			ROS_REGISTRATION_TABLE_FIELD_INTERFACE),
+	SCHEMA_FIELD ("mac-address", SCHEMA_STRING, ros_registration_table_t, mac_address,
+			ROS_REGISTRATION_TABLE_FIELD_MAC_ADDRESS),
+	SCHEMA_FIELD_RX_TX ("packets", ros_registration_table_t, rx_packets, tx_packets,
+			ROS_REGISTRATION_TABLE_FIELD_RX_PACKETS
+			| ROS_REGISTRATION_TABLE_FIELD_TX_PACKETS),
+	SCHEMA_FIELD ("radio-name", SCHEMA_STRING, ros_registration_table_t, radio_name,
+			ROS_REGISTRATION_TABLE_FIELD_RADIO_NAME),
+	SCHEMA_FIELD ("rx-ccq", SCHEMA_DOUBLE, ros_registration_table_t, rx_ccq,
+			ROS_REGISTRATION_TABLE_FIELD_RX_CCQ),
+	SCHEMA_FIELD ("rx-rate", SCHEMA_DOUBLE, ros_registration_table_t, rx_rate,
+			ROS_REGISTRATION_TABLE_FIELD_RX_RATE),
+	SCHEMA_FIELD ("signal-strength", SCHEMA_DOUBLE, ros_registration_table_t,
+			rx_signal_strength,
+			ROS_REGISTRATION_TABLE_FIELD_RX_SIGNAL_STRENGTH),
+	SCHEMA_FIELD ("signal-to-noise", SCHEMA_DOUBLE, ros_registration_table_t,
+			signal_to_noise,
+			ROS_REGISTRATION_TABLE_FIELD_SIGNAL_TO_NOISE),
+	SCHEMA_FIELD ("tx-ccq", SCHEMA_DOUBLE, ros_registration_table_t, tx_ccq,
+			ROS_REGISTRATION_TABLE_FIELD_TX_CCQ),
+	SCHEMA_FIELD ("tx-rate", SCHEMA_DOUBLE, ros_registration_table_t, tx_rate,
+			ROS_REGISTRATION_TABLE_FIELD_TX_RATE),
+	SCHEMA_FIELD ("tx-signal-strength", SCHEMA_DOUBLE, ros_registration_table_t,
+			tx_signal_strength,
+			ROS_REGISTRATION_TABLE_FIELD_TX_SIGNAL_STRENGTH),
+	SCHEMA_FIELD ("wds", SCHEMA_BOOL, ros_registration_table_t, wds,
+			ROS_REGISTRATION_TABLE_FIELD_WDS)
+};
+
 /*
  * Private functions
  */
-static ros_registration_table_t *rt_reply_to_regtable (const ros_reply_t *r) /* {{{ */
+/* Decodes all "re" sentences into one array whose "next" pointers link the
+ * elements. The array is NULL if the reply has no entries. */
+static int rt_reply_to_regtable (const ros_reply_t *r, /* {{{ */
+		ros_registration_table_t **ret_array, size_t *ret_num)
 {
-	ros_registration_table_t *ret;
+	const ros_reply_t *ptr;
+	ros_registration_table_t *array;
+	size_t num;
+	size_t i;
 
-	if (r == NULL)
-		return (NULL);
+	*ret_array = NULL;
+	*ret_num = 0;
 
-	if (strcmp ("re", ros_reply_status (r)) != 0)
-		return (rt_reply_to_regtable (ros_reply_next (r)));
+	num = 0;
+	for (ptr = r; ptr != NULL; ptr = ros_reply_next (ptr))
+		if (strcmp ("re", ros_reply_status (ptr)) == 0)
+			num++;
 
-	ret = malloc (sizeof (*ret));
-	if (ret == NULL)
-		return (NULL);
-	memset (ret, 0, sizeof (*ret));
+	if (num == 0)
+		return (0);
 
-	ret->interface = ros_reply_param_val_by_key (r, "interface");
-	ret->radio_name = ros_reply_param_val_by_key (r, "radio-name");
-	ret->mac_address = ros_reply_param_val_by_key (r, "mac-address");
+	array = calloc (num, sizeof (*array));
+	if (array == NULL)
+		return (ENOMEM);
 
-	ret->ap = sstrtob (ros_reply_param_val_by_key (r, "ap"));
-	ret->wds = sstrtob (ros_reply_param_val_by_key (r, "wds"));
+	i = 0;
+	for (ptr = r; ptr != NULL; ptr = ros_reply_next (ptr))
+	{
+		if (strcmp ("re", ros_reply_status (ptr)) != 0)
+			continue;
+
+		schema_decode (ptr, rt_fields, sizeof (rt_fields) / sizeof (rt_fields[0]),
+				array + i);
+		if (i > 0)
+			array[i - 1].next = array + i;
+		i++;
+	}
 
-	ret->rx_rate = sstrtod (ros_reply_param_val_by_key (r, "rx-rate"));
-	ret->tx_rate = sstrtod (ros_reply_param_val_by_key (r, "tx-rate"));
+	*ret_array = array;
+	*ret_num = num;
+	return (0);
+} /* }}} int rt_reply_to_regtable */
 
-	sstrto_rx_tx_counters (ros_reply_param_val_by_key (r, "packets"),
-			&ret->rx_packets, &ret->tx_packets);
-	sstrto_rx_tx_counters (ros_reply_param_val_by_key (r, "bytes"),
-			&ret->rx_bytes, &ret->tx_bytes);
-	sstrto_rx_tx_counters (ros_reply_param_val_by_key (r, "frames"),
-			&ret->rx_frames, &ret->tx_frames);
-	sstrto_rx_tx_counters (ros_reply_param_val_by_key (r, "frame-bytes"),
-			&ret->rx_frame_bytes, &ret->tx_frame_bytes);
-	sstrto_rx_tx_counters (ros_reply_param_val_by_key (r, "hw-frames"),
-			&ret->rx_hw_frames, &ret->tx_hw_frames);
-	sstrto_rx_tx_counters (ros_reply_param_val_by_key (r, "hw-frame-bytes"),
-			&ret->rx_hw_frame_bytes, &ret->tx_hw_frame_bytes);
+static int rt_internal_handler (ros_connection_t *c, /* {{{ */
+		const ros_reply_t *r, void *user_data)
+{
+	ros_registration_table_t *rt_data;
+	size_t rt_num;
+	rt_internal_data_t *internal_data;
+	int status;
 
-	ret->rx_signal_strength = sstrtod (ros_reply_param_val_by_key (r, "signal-strength"));
-	ret->tx_signal_strength = sstrtod (ros_reply_param_val_by_key (r, "tx-signal-strength"));
-	ret->signal_to_noise = sstrtod (ros_reply_param_val_by_key (r, "signal-to-noise"));
+	status = rt_reply_to_regtable (r, &rt_data, &rt_num);
+	if (status != 0)
+		return (status);
 
-	ret->rx_ccq = sstrtod (ros_reply_param_val_by_key (r, "rx-ccq"));
-	ret->tx_ccq = sstrtod (ros_reply_param_val_by_key (r, "tx-ccq"));
+	/* As before, the list handler is not called for an empty table. */
+	if (rt_num == 0)
+		return (0);
 
-	ret->next = rt_reply_to_regtable (ros_reply_next (r));
+	internal_data = user_data;
 
-	return (ret);
-} /* }}} ros_registration_table_t *rt_reply_to_regtable */
+	status = internal_data->handler (c, rt_data, internal_data->user_data);
 
-static void rt_regtable_free (const ros_registration_table_t *r) /* {{{ */
-{
-	const ros_registration_table_t *next;
+	free (rt_data);
 
-	while (r != NULL)
-	{
-		next = r->next;
-		free ((void *) r);
-		r = next;
-	}
-} /* }}} void rt_regtable_free */
+	return (status);
+} /* }}} int rt_internal_handler */
 
-static int rt_internal_handler (ros_connection_t *c, /* {{{ */
+static int rt_array_internal_handler (ros_connection_t *c, /* {{{ */
 		const ros_reply_t *r, void *user_data)
 {
 	ros_registration_table_t *rt_data;
-	rt_internal_data_t *internal_data;
+	size_t rt_num;
+	rt_array_internal_data_t *internal_data;
 	int status;
 
-	rt_data = rt_reply_to_regtable (r);
-	if (rt_data == NULL)
-		return (errno);
+	status = rt_reply_to_regtable (r, &rt_data, &rt_num);
+	if (status != 0)
+		return (status);
 
 	internal_data = user_data;
 
-	status = internal_data->handler (c, rt_data, internal_data->user_data);
+	status = internal_data->handler (c, rt_data, rt_num,
+			internal_data->user_data);
 
-	rt_regtable_free (rt_data);
+	free (rt_data);
 
 	return (status);
-} /* }}} int rt_internal_handler */
+} /* }}} int rt_array_internal_handler */
+
+/* Used by test_parse to check the table. */
+const schema_field_t *rt_schema (size_t *ret_num) /* {{{ */
+{
+	*ret_num = sizeof (rt_fields) / sizeof (rt_fields[0]);
+	return (rt_fields);
+} /* }}} const schema_field_t *rt_schema */
 
 /*
  * Public functions
  */
 int ros_registration_table (ros_connection_t *c, /* {{{ */
 		ros_registration_table_handler_t handler, void *user_data)
+{
+	return (ros_registration_table_with_options (c, handler, user_data,
+				/* opts = */ NULL));
+} /* }}} int ros_registration_table */
+
+int ros_registration_table_with_options (ros_connection_t *c, /* {{{ */
+		ros_registration_table_handler_t handler, void *user_data,
+		const ros_query_options_t *opts)
 {
 	rt_internal_data_t data;
 
@@ -190,9 +274,33 @@ int ros_registration_table (ros_connection_t *c, /* {{{ */
 	data.handler = handler;
 	data.user_data = user_data;
 
-	return (ros_query (c, "/interface/wireless/registration-table/print",
-				/* args_num = */ 0, /* args = */ NULL,
+	return (schema_query (c, "/interface/wireless/registration-table/print",
+				rt_fields, sizeof (rt_fields) / sizeof (rt_fields[0]), opts,
 				rt_internal_handler, &data));
-} /* }}} int ros_registration_table */
+} /* }}} int ros_registration_table_with_options */
+
+int ros_registration_table_array (ros_connection_t *c, /* {{{ */
+		ros_registration_table_array_handler_t handler, void *user_data)
+{
+	return (ros_registration_table_array_with_options (c, handler, user_data,
+				/* opts = */ NULL));
+} /* }}} int ros_registration_table_array */
+
+int ros_registration_table_array_with_options (ros_connection_t *c, /* {{{ */
+		ros_registration_table_array_handler_t handler, void *user_data,
+		const ros_query_options_t *opts)
+{
+	rt_array_internal_data_t data;
+
+	if ((c == NULL) || (handler == NULL))
+		return (EINVAL);
+
+	data.handler = handler;
+	data.user_data = user_data;
+
+	return (schema_query (c, "/interface/wireless/registration-table/print",
+				rt_fields, sizeof (rt_fields) / sizeof (rt_fields[0]), opts,
+				rt_array_internal_handler, &data));
+} /* }}} int ros_registration_table_array_with_options */
 
 /* vim: set ts=2 sw=2 noet fdm=marker : */
@@ -42,6 +42,7 @@
 static const char *opt_username = "admin";
 static int opt_receive_timeout = 0;
 static int opt_connect_timeout = 0;
+static int opt_query_timeout = 0;
 
 static int result_handler (ros_connection_t *c, const ros_reply_t *r, /* {{{ */
 		void *user_data)
@@ -303,6 +304,7 @@ static void exit_usage (void) /* {{{ */
 			"  -u <user>       Use <user> to authenticate (optional, default: admin).\n"
 			"  -t <timeout>    Set receive timeout in seconds.\n"
 			"  -c <timeout>    Set connect timeout in seconds.\n"
+			"  -q <timeout>    Set query timeout in seconds.\n"
 			"  -h              Display this help message.\n"
 			"\n");
 	if (ros_version () == ROS_VERSION)
@@ -324,7 +326,7 @@ int main (int argc, char **argv) /* {{{ */
 
 	int option;
 
-	while ((option = getopt (argc, argv, "u:t:c:h?")) != -1)
+	while ((option = getopt (argc, argv, "u:t:c:q:h?")) != -1)
 	{
 		switch (option)
 		{
@@ -337,6 +339,9 @@ int main (int argc, char **argv) /* {{{ */
 			case 'c':
 				opt_connect_timeout = atoi(optarg);
 				break;
+			case 'q':
+				opt_query_timeout = atoi(optarg);
+				break;
 
 			case 'h':
 			case '?':
@@ -360,6 +365,7 @@ int main (int argc, char **argv) /* {{{ */
 	ros_connect_opts_t opts = {
 		.receive_timeout = opt_receive_timeout,
 		.connect_timeout = opt_connect_timeout,
+		.query_timeout = opt_query_timeout,
 	};
 	c = ros_connect_with_options (host, ROUTEROS_API_PORT,
 			opt_username, passwd, &opts);
@@ -372,7 +378,7 @@ int main (int argc, char **argv) /* {{{ */
 
 	if (command[0] == '/')
 	{
-		ros_query (c, command,
+		ros_query_stream (c, command,
 				(size_t) (argc - (optind + 2)), (const char * const *) (argv + optind + 2),
 				result_handler, /* user data = */ NULL);
 	}
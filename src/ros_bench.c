@@ -0,0 +1,545 @@
+/**
+ * librouteros - src/ros_bench.c
+ * Copyright (C) 2026  agent
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+ * OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ *
+ * Authors:
+ *   agent <agent at local>
+ **/
+
+/* Benchmarks the library against a fake device running in a child process,
+ * so that no router is needed, and the parsers against the versions without
+ * fast paths in ros_parse_ref.c. Not installed. */
+
+#ifndef _ISOC99_SOURCE
+# define _ISOC99_SOURCE
+#endif
+
+#ifndef _POSIX_C_SOURCE
+# define _POSIX_C_SOURCE 200112L
+#endif
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <signal.h>
+#include <getopt.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "config.h"
+
+#include "routeros_api.h"
+#include "ros_parse.h"
+#include "ros_parse_ref.h"
+
+static unsigned int opt_repeat = 1000;
+static unsigned int opt_sentences = 100;
+static unsigned int opt_params = 20;
+static unsigned int opt_delay = 0;
+static _Bool opt_zero_copy = 0;
+
+/*
+ * Fake device
+ */
+struct buffer_s
+{
+	char *data;
+	size_t size;
+	size_t fill;
+};
+typedef struct buffer_s buffer_t;
+
+static void buffer_append (buffer_t *b, const void *data, size_t len) /* {{{ */
+{
+	if ((b->fill + len) > b->size)
+	{
+		while ((b->fill + len) > b->size)
+			b->size = (b->size > 0) ? (2 * b->size) : 4096;
+		b->data = realloc (b->data, b->size);
+		if (b->data == NULL)
+			exit (EXIT_FAILURE);
+	}
+
+	memcpy (b->data + b->fill, data, len);
+	b->fill += len;
+} /* }}} void buffer_append */
+
+static void buffer_add_word (buffer_t *b, const char *word) /* {{{ */
+{
+	uint8_t prefix[4];
+	size_t len = strlen (word);
+
+	if (len < 0x80)
+	{
+		prefix[0] = (uint8_t) len;
+		buffer_append (b, prefix, 1);
+	}
+	else if (len < 0x4000)
+	{
+		prefix[0] = (uint8_t) ((len >> 8) | 0x80);
+		prefix[1] = (uint8_t) len;
+		buffer_append (b, prefix, 2);
+	}
+	else
+	{
+		prefix[0] = (uint8_t) ((len >> 16) | 0xC0);
+		prefix[1] = (uint8_t) (len >> 8);
+		prefix[2] = (uint8_t) len;
+		buffer_append (b, prefix, 3);
+	}
+
+	buffer_append (b, word, len);
+} /* }}} void buffer_add_word */
+
+/* The "!re" sentences of a reply without their ".tag" and terminating
+ * empty word, built once so that the device is cheap compared to the
+ * library. Sentence "i" ends at reply_ends[i]. */
+static buffer_t reply_sentences = { NULL, 0, 0 };
+static size_t *reply_ends = NULL;
+
+/* Keys of the parameters, see lookup_handler. */
+static char **param_keys = NULL;
+
+static void reply_init (void) /* {{{ */
+{
+	char word[64];
+	unsigned int i;
+	unsigned int j;
+
+	reply_ends = calloc (opt_sentences + 1, sizeof (*reply_ends));
+	param_keys = calloc (opt_params + 1, sizeof (*param_keys));
+	if ((reply_ends == NULL) || (param_keys == NULL))
+		exit (EXIT_FAILURE);
+
+	for (i = 0; i < opt_sentences; i++)
+	{
+		buffer_add_word (&reply_sentences, "!re");
+		for (j = 0; j < opt_params; j++)
+		{
+			snprintf (word, sizeof (word), "=key-%u=value %u of sentence %u",
+					j, j, i);
+			buffer_add_word (&reply_sentences, word);
+		}
+		reply_ends[i] = reply_sentences.fill;
+	}
+
+	for (j = 0; j < opt_params; j++)
+	{
+		param_keys[j] = malloc (32);
+		if (param_keys[j] == NULL)
+			exit (EXIT_FAILURE);
+		snprintf (param_keys[j], 32, "key-%u", j);
+	}
+} /* }}} void reply_init */
+
+/* Appends the reply to one command. "tag" is the ".tag" word of the
+ * command, or NULL. */
+static void device_reply (buffer_t *b, const char *command, /* {{{ */
+		const char *tag)
+{
+	size_t start = 0;
+	unsigned int i;
+
+	if (strcmp ("/login", command) != 0)
+	{
+		for (i = 0; i < opt_sentences; i++)
+		{
+			buffer_append (b, reply_sentences.data + start,
+					reply_ends[i] - start);
+			start = reply_ends[i];
+			if (tag != NULL)
+				buffer_add_word (b, tag);
+			buffer_add_word (b, "");
+		}
+	}
+
+	buffer_add_word (b, "!done");
+	if (tag != NULL)
+		buffer_add_word (b, tag);
+	buffer_add_word (b, "");
+} /* }}} void device_reply */
+
+/* Answers the commands received on "fd" until the connection is closed. All
+ * commands read at once are answered at once, after "opt_delay"
+ * milliseconds, which simulates the round trip time. */
+static void device_serve (int fd) /* {{{ */
+{
+	buffer_t in = { NULL, 0, 0 };
+	buffer_t out = { NULL, 0, 0 };
+	char command[256] = "";
+	char tag[128] = "";
+
+	while (42)
+	{
+		char chunk[65536];
+		ssize_t status;
+		size_t pos;
+
+		status = read (fd, chunk, sizeof (chunk));
+		if (status <= 0)
+			break;
+		buffer_append (&in, chunk, (size_t) status);
+
+		/* Words sent by the library are shorter than 0x80 bytes, except
+		 * for long arguments, which this device does not need. */
+		pos = 0;
+		while (pos < in.fill)
+		{
+			size_t len = (uint8_t) in.data[pos];
+			char word[128];
+
+			if ((len >= 0x80) || ((pos + 1 + len) > in.fill))
+				break;
+			memcpy (word, in.data + pos + 1, len);
+			word[len] = 0;
+			pos += 1 + len;
+
+			if (len == 0)
+			{
+				device_reply (&out, command, (tag[0] != 0) ? tag : NULL);
+				command[0] = 0;
+				tag[0] = 0;
+			}
+			else if (command[0] == 0)
+				snprintf (command, sizeof (command), "%s", word);
+			else if (strncmp (".tag=", word, 5) == 0)
+				snprintf (tag, sizeof (tag), "%s", word);
+		}
+		memmove (in.data, in.data + pos, in.fill - pos);
+		in.fill -= pos;
+
+		if (out.fill == 0)
+			continue;
+
+		if (opt_delay > 0)
+		{
+			struct timespec ts;
+
+			ts.tv_sec = opt_delay / 1000;
+			ts.tv_nsec = 1000000 * (long) (opt_delay % 1000);
+			nanosleep (&ts, NULL);
+		}
+
+		for (pos = 0; pos < out.fill; pos += (size_t) status)
+		{
+			status = write (fd, out.data + pos, out.fill - pos);
+			if (status <= 0)
+				return;
+		}
+		out.fill = 0;
+	}
+} /* }}} void device_serve */
+
+/* Forks the fake device. Returns its port in "ret_port". */
+static pid_t device_start (char *ret_port, size_t ret_port_size) /* {{{ */
+{
+	struct sockaddr_in addr;
+	socklen_t addr_len = sizeof (addr);
+	pid_t pid;
+	int fd;
+
+	fd = socket (AF_INET, SOCK_STREAM, 0);
+	if (fd < 0)
+		return (-1);
+
+	memset (&addr, 0, sizeof (addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+	if ((bind (fd, (struct sockaddr *) &addr, sizeof (addr)) != 0)
+			|| (listen (fd, 1) != 0)
+			|| (getsockname (fd, (struct sockaddr *) &addr, &addr_len) != 0))
+	{
+		close (fd);
+		return (-1);
+	}
+	snprintf (ret_port, ret_port_size, "%u", (unsigned int) ntohs (addr.sin_port));
+
+	pid = fork ();
+	if (pid == 0)
+	{
+		int client;
+
+		while ((client = accept (fd, NULL, NULL)) >= 0)
+		{
+			device_serve (client);
+			close (client);
+		}
+		exit (EXIT_SUCCESS);
+	}
+
+	close (fd);
+	return (pid);
+} /* }}} pid_t device_start */
+
+/*
+ * Benchmarks
+ */
+static double now_us (void) /* {{{ */
+{
+	struct timespec ts;
+
+	clock_gettime (CLOCK_MONOTONIC, &ts);
+	return ((1e6 * (double) ts.tv_sec) + ((double) ts.tv_nsec / 1e3));
+} /* }}} double now_us */
+
+static int count_handler (__attribute__((unused)) ros_connection_t *c, /* {{{ */
+		const ros_reply_t *r, void *user_data)
+{
+	unsigned int *count = user_data;
+
+	for (; r != NULL; r = ros_reply_next (r))
+		(*count)++;
+
+	return (0);
+} /* }}} int count_handler */
+
+/* Looks up every parameter of every sentence by key. */
+static int lookup_handler (__attribute__((unused)) ros_connection_t *c, /* {{{ */
+		const ros_reply_t *r, void *user_data)
+{
+	unsigned int *count = user_data;
+
+	for (; r != NULL; r = ros_reply_next (r))
+	{
+		unsigned int i;
+
+		for (i = 0; i < opt_params; i++)
+			if (ros_reply_param_val_by_key (r, param_keys[i]) != NULL)
+				(*count)++;
+	}
+
+	return (0);
+} /* }}} int lookup_handler */
+
+static int bench_query (ros_connection_t *c, /* {{{ */
+		ros_reply_handler_t handler, const char *name)
+{
+	unsigned int count = 0;
+	double start;
+	unsigned int i;
+	int status;
+
+	start = now_us ();
+	for (i = 0; i < opt_repeat; i++)
+	{
+		status = ros_query (c, "/bench", 0, NULL, handler, &count);
+		if (status != 0)
+			return (status);
+	}
+
+	printf ("%s: %u sentences x %u params: %.1f us/query (%u results)\n",
+			name, opt_sentences, opt_params,
+			(now_us () - start) / (double) opt_repeat, count);
+	return (0);
+} /* }}} int bench_query */
+
+/* Sends opt_repeat commands one at a time, then all at once. */
+static int bench_pipeline (ros_connection_t *c) /* {{{ */
+{
+	unsigned int count = 0;
+	double start;
+	unsigned int i;
+	int status;
+
+	start = now_us ();
+	for (i = 0; i < opt_repeat; i++)
+	{
+		status = ros_query (c, "/bench", 0, NULL, count_handler, &count);
+		if (status != 0)
+			return (status);
+	}
+	printf ("sequential: %u queries, %u ms delay: %.1f ms\n",
+			opt_repeat, opt_delay, (now_us () - start) / 1e3);
+
+	start = now_us ();
+	for (i = 0; i < opt_repeat; i++)
+	{
+		status = ros_query_start (c, "/bench", 0, NULL, count_handler, &count);
+		if (status != 0)
+			return (status);
+	}
+	status = ros_query_wait (c);
+	if (status != 0)
+		return (status);
+	printf ("pipelined:  %u queries, %u ms delay: %.1f ms\n",
+			opt_repeat, opt_delay, (now_us () - start) / 1e3);
+
+	return (0);
+} /* }}} int bench_pipeline */
+
+/* Values as found in interface, registration table and resource replies. */
+static const char *parse_numbers[] =
+{
+	"0", "1", "1500", "65535", "123456", "98765432", "1234567890",
+	"283741928374", "18446744073709551615", "42",
+};
+
+static const char *parse_doubles[] =
+{
+	"0", "-74", "-96", "58.5", "52.0", "1.2", "216.7", "5", "0.25", "100",
+};
+
+static const char *parse_rx_tx[] =
+{
+	"0/0", "1234/5678", "9876543210/1234567890", "15,7", "300/200",
+	"18446744073709551615/1", "1/1", "65535/65535", "42/42", "7/0",
+};
+
+static const char *parse_dates[] =
+{
+	"6w6d18:33:07", "1d", "18:33:07", "33:07", "5m30s", "2h", "1y2w3d4h5m6s",
+	"00:00:01", "3w", "10s",
+};
+
+#define PARSE_CORPUS_SIZE 10
+
+/* Runs "expr" over "corpus" opt_repeat times and prints the time per call.
+ * The results are summed so the calls cannot be optimized away. */
+#define PARSE_BENCH(name, corpus, expr) do { \
+	double start = now_us (); \
+	unsigned int n; \
+	size_t k; \
+	for (n = 0; n < opt_repeat; n++) \
+		for (k = 0; k < PARSE_CORPUS_SIZE; k++) \
+		{ \
+			const char *str = (corpus)[k]; \
+			sum += (double) (expr); \
+		} \
+	printf ("%-40s %6.1f ns/call\n", (name), \
+			1e3 * (now_us () - start) / (1.0 * opt_repeat * PARSE_CORPUS_SIZE)); \
+} while (0)
+
+static int bench_parse (void) /* {{{ */
+{
+	volatile double sum = 0.0;
+	uint64_t rx, tx;
+
+	PARSE_BENCH ("sstrtoui64", parse_numbers, sstrtoui64 (str));
+	PARSE_BENCH ("reference_strtoui64", parse_numbers,
+			reference_strtoui64 (str));
+	PARSE_BENCH ("sstrtod", parse_doubles, sstrtod (str));
+	PARSE_BENCH ("reference_strtod", parse_doubles, reference_strtod (str));
+	PARSE_BENCH ("sstrto_rx_tx_counters", parse_rx_tx,
+			sstrto_rx_tx_counters (str, &rx, &tx) + rx + tx);
+	PARSE_BENCH ("reference_strto_rx_tx_counters", parse_rx_tx,
+			reference_strto_rx_tx_counters (str, &rx, &tx) + rx + tx);
+	PARSE_BENCH ("sstrtodate", parse_dates, sstrtodate (str));
+	PARSE_BENCH ("reference_strtodate", parse_dates,
+			reference_strtodate (str, /* have_hour = */ 0));
+
+	return ((sum < 0.0) ? -1 : 0);
+} /* }}} int bench_parse */
+
+static void exit_usage (void) /* {{{ */
+{
+	printf ("Usage: ros_bench [options] reply|lookup|pipeline|parse\n"
+			"\n"
+			"Options:\n"
+			"  -n <num>    Number of queries or parser runs (default: 1000)\n"
+			"  -r <num>    Sentences per reply (default: 100)\n"
+			"  -p <num>    Parameters per sentence (default: 20)\n"
+			"  -d <ms>     Delay before the device answers (default: 0)\n"
+			"  -z          Use zero-copy mode\n"
+			"\n");
+	exit (EXIT_FAILURE);
+} /* }}} void exit_usage */
+
+int main (int argc, char **argv) /* {{{ */
+{
+	ros_connect_opts_t opts;
+	ros_connection_t *c;
+	char port[16];
+	pid_t pid;
+	int option;
+	int status;
+
+	while ((option = getopt (argc, argv, "n:r:p:d:zh?")) != -1)
+	{
+		switch (option)
+		{
+			case 'n':
+				opt_repeat = (unsigned int) atoi (optarg);
+				break;
+			case 'r':
+				opt_sentences = (unsigned int) atoi (optarg);
+				break;
+			case 'p':
+				opt_params = (unsigned int) atoi (optarg);
+				break;
+			case 'd':
+				opt_delay = (unsigned int) atoi (optarg);
+				break;
+			case 'z':
+				opt_zero_copy = 1;
+				break;
+			default:
+				exit_usage ();
+		}
+	}
+
+	if ((optind + 1) != argc)
+		exit_usage ();
+
+	/* Needs no device. */
+	if (strcmp ("parse", argv[optind]) == 0)
+		return ((bench_parse () == 0) ? EXIT_SUCCESS : EXIT_FAILURE);
+
+	reply_init ();
+
+	pid = device_start (port, sizeof (port));
+	if (pid < 0)
+	{
+		fprintf (stderr, "Starting the device failed: %s\n", strerror (errno));
+		exit (EXIT_FAILURE);
+	}
+
+	memset (&opts, 0, sizeof (opts));
+	opts.zero_copy = opt_zero_copy;
+
+	c = ros_connect_with_options ("127.0.0.1", port, "admin", "admin", &opts);
+	if (c == NULL)
+	{
+		fprintf (stderr, "ros_connect failed: %s\n", strerror (errno));
+		kill (pid, SIGTERM);
+		exit (EXIT_FAILURE);
+	}
+
+	if (strcmp ("reply", argv[optind]) == 0)
+		status = bench_query (c, count_handler, "reply");
+	else if (strcmp ("lookup", argv[optind]) == 0)
+		status = bench_query (c, lookup_handler, "lookup");
+	else if (strcmp ("pipeline", argv[optind]) == 0)
+		status = bench_pipeline (c);
+	else
+		exit_usage ();
+
+	if (status != 0)
+		fprintf (stderr, "Query failed: %s\n", strerror (status));
+
+	ros_disconnect (c);
+	kill (pid, SIGTERM);
+	waitpid (pid, NULL, 0);
+
+	return ((status == 0) ? EXIT_SUCCESS : EXIT_FAILURE);
+} /* }}} int main */
+
+/* vim: set ts=2 sw=2 noet fdm=marker : */
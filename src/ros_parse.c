@@ -29,16 +29,20 @@
 #include "config.h"
 
 #include <stdlib.h>
+#include <stddef.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <inttypes.h>
 #include <string.h>
 #include <strings.h>
 #include <math.h>
+#include <float.h>
 #include <errno.h>
+#include <locale.h>
 #include <assert.h>
 
 #include "routeros_api.h"
+#include "ros_parse.h"
 
 _Bool sstrtob (const char *str) /* {{{ */
 {
@@ -67,18 +71,64 @@ unsigned int sstrtoui (const char *str) /* {{{ */
 	return (ret);
 } /* }}} unsigned int sstrtoui */
 
+/* Like strtoull(3) with base 10, but returns the error in "ret_errno". Plain
+ * digit strings, by far the most common case, are converted without calling
+ * the locale aware C library function. */
+static uint64_t parse_uint64 (const char *str, char **endptr, /* {{{ */
+		int *ret_errno)
+{
+	const char *ptr;
+	uint64_t ret;
+	_Bool overflow;
+
+	if ((*str < '0') || (*str > '9'))
+	{
+		errno = 0;
+		ret = (uint64_t) strtoull (str, endptr, /* base = */ 10);
+		*ret_errno = errno;
+		return (ret);
+	}
+
+	/* Up to 19 digits cannot overflow. */
+	ret = 0;
+	for (ptr = str; (*ptr >= '0') && (*ptr <= '9') && ((ptr - str) < 19); ptr++)
+		ret = (10 * ret) + (uint64_t) (*ptr - '0');
+
+	overflow = false;
+	for (; (*ptr >= '0') && (*ptr <= '9'); ptr++)
+	{
+		uint64_t digit = (uint64_t) (*ptr - '0');
+
+		if ((ret > (UINT64_MAX / 10))
+				|| ((ret == (UINT64_MAX / 10)) && (digit > (UINT64_MAX % 10))))
+			overflow = true;
+		else
+			ret = (10 * ret) + digit;
+	}
+
+	*endptr = (char *) ptr;
+	if (overflow)
+	{
+		*ret_errno = ERANGE;
+		return (UINT64_MAX);
+	}
+
+	*ret_errno = 0;
+	return (ret);
+} /* }}} uint64_t parse_uint64 */
+
 uint64_t sstrtoui64 (const char *str) /* {{{ */
 {
 	uint64_t ret;
 	char *endptr;
+	int status;
 
 	if (str == NULL)
 		return (0);
 
-	errno = 0;
 	endptr = NULL;
-	ret = (uint64_t) strtoull (str, &endptr, /* base = */ 10);
-	if ((endptr == str) || (errno != 0))
+	ret = parse_uint64 (str, &endptr, &status);
+	if ((endptr == str) || (status != 0))
 		return (0);
 
 	return (ret);
@@ -86,12 +136,56 @@ uint64_t sstrtoui64 (const char *str) /* {{{ */
 
 double sstrtod (const char *str) /* {{{ */
 {
+	/* Exactly representable powers of ten. */
+	static const double pow10[] = { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7,
+		1e8, 1e9, 1e10, 1e11, 1e12, 1e13, 1e14, 1e15 };
+
 	double ret;
 	char *endptr;
 
 	if (str == NULL)
 		return (NAN);
 
+#if FLT_EVAL_METHOD == 0
+	/* Fast path for values like "-74" or "58.5Mbps": If the digits fit into
+	 * the mantissa, one correctly rounded division yields the same result as
+	 * strtod(3). Everything else, e.g. exponents, is left to the C library.
+	 * So is everything if the locale's decimal point is not '.', so that the
+	 * result never depends on which path is taken. */
+	if (strcmp (".", localeconv ()->decimal_point) == 0)
+	{
+		const char *ptr = str;
+		_Bool negative = false;
+		uint64_t mantissa = 0;
+		int digits_num = 0;
+		int fraction_num = 0;
+
+		if (*ptr == '-')
+		{
+			negative = true;
+			ptr++;
+		}
+
+		for (; (*ptr >= '0') && (*ptr <= '9'); ptr++, digits_num++)
+			mantissa = (10 * mantissa) + (uint64_t) (*ptr - '0');
+
+		if (*ptr == '.')
+		{
+			for (ptr++; (*ptr >= '0') && (*ptr <= '9'); ptr++, fraction_num++)
+				mantissa = (10 * mantissa) + (uint64_t) (*ptr - '0');
+		}
+		digits_num += fraction_num;
+
+		if ((digits_num > 0) && (digits_num <= 15)
+				&& (*ptr != 'e') && (*ptr != 'E')
+				&& (*ptr != 'x') && (*ptr != 'X'))
+		{
+			ret = ((double) mantissa) / pow10[fraction_num];
+			return (negative ? -ret : ret);
+		}
+	}
+#endif
+
 	errno = 0;
 	endptr = NULL;
 	ret = strtod (str, &endptr);
@@ -106,6 +200,7 @@ int sstrto_rx_tx_counters (const char *str, /* {{{ */
 {
 	const char *ptr;
 	char *endptr;
+	int status;
 
 	if ((rx == NULL) || (tx == NULL))
 		return (EINVAL);
@@ -117,10 +212,9 @@ int sstrto_rx_tx_counters (const char *str, /* {{{ */
 		return (EINVAL);
 
 	ptr = str;
-	errno = 0;
 	endptr = NULL;
-	*rx = (uint64_t) strtoull (ptr, &endptr, /* base = */ 10);
-	if ((endptr == str) || (errno != 0))
+	*rx = parse_uint64 (ptr, &endptr, &status);
+	if ((endptr == str) || (status != 0))
 	{
 		*rx = 0;
 		return (EIO);
@@ -130,11 +224,11 @@ int sstrto_rx_tx_counters (const char *str, /* {{{ */
 	if ((*endptr != '/') && (*endptr != ','))
 		return (EIO);
 
+	/* A missing transmit counter is taken as zero. */
 	ptr = endptr + 1;
-	errno = 0;
 	endptr = NULL;
-	*tx = (uint64_t) strtoull (ptr, &endptr, /* base = */ 10);
-	if ((endptr == str) || (errno != 0))
+	*tx = parse_uint64 (ptr, &endptr, &status);
+	if (status != 0)
 	{
 		*rx = 0;
 		*tx = 0;
@@ -149,31 +243,219 @@ int sstrto_rx_tx_counters (const char *str, /* {{{ */
  * is hours or minutes. External code should use the sstrtodate() macro. */
 uint64_t _sstrtodate (const char *str, _Bool have_hour) /* {{{ */
 {
-	uint64_t ret;
-	char *endptr;
-
-	if ((str == NULL) || (*str == 0))
-		return (0);
+	uint64_t sum = 0;
 
 	/* Example string: 6w6d18:33:07 */
-	errno = 0;
-	endptr = NULL;
-	ret = (uint64_t) strtoull (str, &endptr, /* base = */ 10);
-	if ((endptr == str) || (errno != 0))
-		return (0);
-
-	switch (*endptr)
+	while ((str != NULL) && (*str != 0))
 	{
-		case 'y': ret *= 365 * 86400; break;
-		case 'w': ret *=   7 * 86400; break;
-		case 'd': ret *=       86400; break;
-		case 'h': ret *=        3600; break;
-		case 'm': ret *=          60; break;
-		case 's': ret *=           1; break;
-		case ':': ret *= have_hour ? 60 : 3600; have_hour = true; break;
+		uint64_t ret;
+		char *endptr;
+		int status;
+
+		endptr = NULL;
+		ret = parse_uint64 (str, &endptr, &status);
+		if ((endptr == str) || (status != 0))
+			break;
+
+		switch (*endptr)
+		{
+			case 'y': ret *= 365 * 86400; break;
+			case 'w': ret *=   7 * 86400; break;
+			case 'd': ret *=       86400; break;
+			case 'h': ret *=        3600; break;
+			case 'm': ret *=          60; break;
+			case 's': ret *=           1; break;
+			case ':': ret *= have_hour ? 60 : 3600; have_hour = true; break;
+		}
+		sum += ret;
+
+		if (*endptr == 0)
+			break;
+		str = endptr + 1;
 	}
 
-	return (ret + _sstrtodate (endptr + 1, have_hour));
+	return (sum);
 } /* }}} uint64_t _sstrtodate */
 
+static int schema_field_compare (const void *key, const void *field) /* {{{ */
+{
+	return (strcmp ((const char *) key, ((const schema_field_t *) field)->key));
+} /* }}} int schema_field_compare */
+
+static void schema_field_set (const schema_field_t *f, /* {{{ */
+		const char *value, char *ret)
+{
+	switch (f->type)
+	{
+		case SCHEMA_STRING:
+			*((const char **) (ret + f->offset)) = value;
+			break;
+		case SCHEMA_BOOL:
+			*((_Bool *) (ret + f->offset)) = sstrtob (value);
+			break;
+		case SCHEMA_BOOL_NOT:
+			*((_Bool *) (ret + f->offset)) = !sstrtob (value);
+			break;
+		case SCHEMA_UINT:
+			*((unsigned int *) (ret + f->offset)) = sstrtoui (value);
+			break;
+		case SCHEMA_UINT64:
+			*((uint64_t *) (ret + f->offset)) = sstrtoui64 (value);
+			break;
+		case SCHEMA_DOUBLE:
+			*((double *) (ret + f->offset)) = sstrtod (value);
+			break;
+		case SCHEMA_DATE:
+			*((uint64_t *) (ret + f->offset)) = sstrtodate (value);
+			break;
+		case SCHEMA_RX_TX:
+			sstrto_rx_tx_counters (value, (uint64_t *) (ret + f->offset),
+					(uint64_t *) (ret + f->offset_tx));
+			break;
+		default:
+			assert (23 == 42);
+	}
+} /* }}} void schema_field_set */
+
+int schema_decode (const ros_reply_t *r, /* {{{ */
+		const schema_field_t *fields, size_t fields_num, void *ret)
+{
+	uint64_t seen = 0;
+	unsigned int i;
+	size_t j;
+
+	if ((r == NULL) || (fields == NULL) || (fields_num > 64) || (ret == NULL))
+		return (EINVAL);
+
+	/* Missing parameters are decoded like with the value NULL. */
+	for (j = 0; j < fields_num; j++)
+		schema_field_set (&fields[j], /* value = */ NULL, ret);
+
+	for (i = 0; /* true */; i++)
+	{
+		const char *key = ros_reply_param_key_by_index (r, i);
+		const schema_field_t *f;
+
+		if (key == NULL)
+			break;
+
+		f = bsearch (key, fields, fields_num, sizeof (*fields),
+				schema_field_compare);
+		if (f == NULL)
+			continue;
+
+		if ((f->only_with != NULL)
+				&& (ros_reply_param_val_by_key (r, f->only_with) == NULL))
+			continue;
+		if ((f->only_without != NULL)
+				&& (ros_reply_param_val_by_key (r, f->only_without) != NULL))
+			continue;
+
+		/* Like ros_reply_param_val_by_key, use the first of duplicate keys. */
+		j = (size_t) (f - fields);
+		if (seen & (((uint64_t) 1) << j))
+			continue;
+		seen |= ((uint64_t) 1) << j;
+
+		schema_field_set (f, ros_reply_param_val_by_index (r, i), ret);
+	}
+
+	return (0);
+} /* }}} int schema_decode */
+
+/* Appends "key" to the list in "buffer", unless it is already there. */
+static int schema_proplist_add (char *buffer, size_t buffer_size, /* {{{ */
+		size_t prefix_len, size_t *offset, const char *key)
+{
+	size_t key_len = strlen (key);
+	const char *ptr;
+
+	for (ptr = buffer + prefix_len; *ptr != 0; ptr++)
+	{
+		if ((strncmp (ptr, key, key_len) == 0)
+				&& ((ptr[key_len] == ',') || (ptr[key_len] == 0)))
+			return (0);
+
+		ptr = strchr (ptr, ',');
+		if (ptr == NULL)
+			break;
+	}
+
+	/* Separator, key and terminating null byte. */
+	if ((*offset + 1 + key_len + 1) > buffer_size)
+		return (ENOBUFS);
+
+	if (*offset > prefix_len)
+		buffer[(*offset)++] = ',';
+	memcpy (buffer + *offset, key, key_len + 1);
+	*offset += key_len;
+
+	return (0);
+} /* }}} int schema_proplist_add */
+
+int schema_proplist (const schema_field_t *fields, /* {{{ */
+		size_t fields_num, uint64_t mask, char *buffer, size_t buffer_size)
+{
+	static const char prefix[] = "=.proplist=";
+	size_t offset;
+	size_t i;
+
+	if ((fields == NULL) || (buffer == NULL)
+			|| (buffer_size < sizeof (prefix)))
+		return (EINVAL);
+
+	memcpy (buffer, prefix, sizeof (prefix));
+	offset = sizeof (prefix) - 1;
+
+	for (i = 0; i < fields_num; i++)
+	{
+		/* The keys a field depends on are needed to decode it. */
+		const char *keys[3] = { fields[i].key,
+			fields[i].only_with, fields[i].only_without };
+		size_t j;
+
+		if ((fields[i].mask & mask) == 0)
+			continue;
+
+		for (j = 0; j < 3; j++)
+		{
+			int status;
+
+			if (keys[j] == NULL)
+				continue;
+
+			status = schema_proplist_add (buffer, buffer_size,
+					sizeof (prefix) - 1, &offset, keys[j]);
+			if (status != 0)
+				return (status);
+		}
+	}
+
+	return (0);
+} /* }}} int schema_proplist */
+
+int schema_query (ros_connection_t *c, const char *command, /* {{{ */
+		const schema_field_t *fields, size_t fields_num,
+		const ros_query_options_t *opts,
+		ros_reply_handler_t handler, void *user_data)
+{
+	char proplist[512];
+	const char *args[1];
+	int status;
+
+	if ((opts == NULL) || (opts->fields == 0))
+		return (ros_query_with_options (c, command,
+					/* args_num = */ 0, /* args = */ NULL,
+					handler, user_data, opts));
+
+	status = schema_proplist (fields, fields_num, opts->fields,
+			proplist, sizeof (proplist));
+	if (status != 0)
+		return (status);
+
+	args[0] = proplist;
+	return (ros_query_with_options (c, command, /* args_num = */ 1, args,
+				handler, user_data, opts));
+} /* }}} int schema_query */
+
 /* vim: set ts=2 sw=2 noet fdm=marker : */
@@ -33,6 +33,73 @@ int sstrto_rx_tx_counters (const char *str, uint64_t *rx, uint64_t *tx);
 uint64_t _sstrtodate (const char *str, _Bool have_hour);
 #define sstrtodate(str) _sstrtodate((str), 0)
 
+/*
+ * Table driven decoding of reply sentences into structs
+ */
+#define SCHEMA_STRING     1 /* const char * */
+#define SCHEMA_BOOL       2 /* _Bool */
+#define SCHEMA_BOOL_NOT   3 /* _Bool, negated; true if missing */
+#define SCHEMA_UINT       4 /* unsigned int */
+#define SCHEMA_UINT64     5 /* uint64_t */
+#define SCHEMA_DOUBLE     6 /* double; NAN if missing */
+#define SCHEMA_DATE       7 /* uint64_t, seconds */
+#define SCHEMA_RX_TX      8 /* two uint64_t, see sstrto_rx_tx_counters */
+
+struct schema_field_s
+{
+	const char *key;
+	int type;
+	size_t offset;
+	/* Only used by SCHEMA_RX_TX: offset of the transmit counter. */
+	size_t offset_tx;
+	/* ROS_*_FIELD_* flags of the members set by this key. */
+	uint64_t mask;
+	/* If not NULL, the key is ignored unless the sentence has the parameter
+	 * "only_with", or if it has the parameter "only_without", respectively.
+	 * Used where a device reports the same member in two formats. */
+	const char *only_with;
+	const char *only_without;
+};
+typedef struct schema_field_s schema_field_t;
+
+#define SCHEMA_FIELD(key, type, struct_type, member, mask) \
+	{ (key), (type), offsetof (struct_type, member), 0, (mask), NULL, NULL }
+#define SCHEMA_FIELD_RX_TX(key, struct_type, member_rx, member_tx, mask) \
+	{ (key), SCHEMA_RX_TX, offsetof (struct_type, member_rx), \
+		offsetof (struct_type, member_tx), (mask), NULL, NULL }
+#define SCHEMA_FIELD_WITHOUT(key, type, struct_type, member, mask, without) \
+	{ (key), (type), offsetof (struct_type, member), 0, (mask), \
+		NULL, (without) }
+#define SCHEMA_FIELD_RX_TX_WITH(key, struct_type, member_rx, member_tx, mask, \
+		with) \
+	{ (key), SCHEMA_RX_TX, offsetof (struct_type, member_rx), \
+		offsetof (struct_type, member_tx), (mask), (with), NULL }
+
+/* The tables of interface.c, registration_table.c, system_resource.c and
+ * system_health.c. */
+const schema_field_t *if_schema (size_t *ret_num);
+const schema_field_t *rt_schema (size_t *ret_num);
+const schema_field_t *sr_schema (size_t *ret_num);
+const schema_field_t *sh_schema (size_t *ret_num);
+
+/* Decodes the parameters of the sentence "r" into the struct "ret". The
+ * fields must be sorted by key, in strcmp() order, which "make check"
+ * verifies for the tables above. At most 64 fields are supported. */
+int schema_decode (const ros_reply_t *r,
+		const schema_field_t *fields, size_t fields_num, void *ret);
+
+/* Formats the "=.proplist=" argument requesting all keys which set one of the
+ * members selected by "mask". Returns ENOBUFS if "buffer" is too small. */
+int schema_proplist (const schema_field_t *fields, size_t fields_num,
+		uint64_t mask, char *buffer, size_t buffer_size);
+
+/* Sends "command" using ros_query_with_options. If "opts" selects fields,
+ * the properties are restricted to those using ".proplist". */
+int schema_query (ros_connection_t *c, const char *command,
+		const schema_field_t *fields, size_t fields_num,
+		const ros_query_options_t *opts,
+		ros_reply_handler_t handler, void *user_data);
+
 #endif /* ROS_PARSE_H */
 
 /* vim: set ts=2 sw=2 noet fdm=marker : */
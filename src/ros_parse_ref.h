@@ -0,0 +1,41 @@
+/**
+ * librouteros - src/ros_parse_ref.h
+ * Copyright (C) 2026  agent
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+ * OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ *
+ * Authors:
+ *   agent <agent at local>
+ **/
+
+/* The parsers of ros_parse.c as they were before their fast paths were
+ * added, built on the C library's strtoull(3) and strtod(3). Used by
+ * test_parse to check that the results are unchanged and by ros_bench to
+ * measure the difference. Not part of the library. */
+
+#ifndef ROS_PARSE_REF_H
+#define ROS_PARSE_REF_H 1
+
+uint64_t reference_strtoui64 (const char *str);
+
+/* Returns NAN if "str" is not a number. */
+double reference_strtod (const char *str);
+
+int reference_strto_rx_tx_counters (const char *str,
+		uint64_t *rx, uint64_t *tx);
+
+uint64_t reference_strtodate (const char *str, _Bool have_hour);
+
+#endif /* ROS_PARSE_REF_H */
+
+/* vim: set ts=2 sw=2 noet fdm=marker : */
@@ -0,0 +1,79 @@
+/**
+ * librouteros - src/ros_util.c
+ * Copyright (C) 2026  agent
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+ * OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ *
+ * Authors:
+ *   agent <agent at local>
+ **/
+
+#ifndef _ISOC99_SOURCE
+# define _ISOC99_SOURCE
+#endif
+
+#ifndef _POSIX_C_SOURCE
+# define _POSIX_C_SOURCE 200112L
+#endif
+
+#include "config.h"
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include "ros_util.h"
+
+/*
+ * Internal functions shared by the modules of the library
+ */
+char *sstrdup (const char *s) /* {{{ */
+{
+	size_t len;
+	char *ret;
+
+	if (s == NULL)
+		return (NULL);
+
+	len = strlen (s) + 1;
+	ret = malloc (len);
+	if (ret == NULL)
+		return (NULL);
+	memcpy (ret, s, len);
+
+	return (ret);
+} /* }}} char *sstrdup */
+
+uint64_t clock_now_ns (void) /* {{{ */
+{
+	struct timespec ts;
+
+	if (clock_gettime (CLOCK_MONOTONIC, &ts) != 0)
+		return (0);
+
+	return ((((uint64_t) ts.tv_sec) * 1000000000) + ((uint64_t) ts.tv_nsec));
+} /* }}} uint64_t clock_now_ns */
+
+uint32_t fnv1a (uint32_t hash, const char *str) /* {{{ */
+{
+	for (; *str != 0; str++)
+	{
+		hash ^= (uint8_t) *str;
+		hash *= FNV1A_PRIME;
+	}
+
+	return (hash);
+} /* }}} uint32_t fnv1a */
+
+/* vim: set ts=2 sw=2 noet fdm=marker : */
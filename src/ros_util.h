@@ -0,0 +1,42 @@
+/**
+ * librouteros - src/ros_util.h
+ * Copyright (C) 2026  agent
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+ * OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ *
+ * Authors:
+ *   agent <agent at local>
+ **/
+
+#ifndef ROS_UTIL_H
+#define ROS_UTIL_H 1
+
+/* Like strdup(3), which is not part of POSIX.1-2001. Returns NULL if "s" is
+ * NULL. */
+char *sstrdup (const char *s);
+
+/* Returns the value of the monotonic clock in nanoseconds, or zero if it is
+ * not available. */
+uint64_t clock_now_ns (void);
+#define clock_now_ms() (clock_now_ns () / 1000000)
+#define clock_now_s() (clock_now_ns () / 1000000000)
+
+/* FNV-1a. Hashes "str" into "hash", which starts out as FNV1A_INIT, so that
+ * several strings can be hashed as one key. */
+#define FNV1A_INIT  2166136261U
+#define FNV1A_PRIME 16777619U
+uint32_t fnv1a (uint32_t hash, const char *str);
+
+#endif /* ROS_UTIL_H */
+
+/* vim: set ts=2 sw=2 noet fdm=marker : */
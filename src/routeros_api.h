@@ -23,6 +23,8 @@
 
 #include <stdint.h>
 #include <inttypes.h>
+#include <sys/types.h>
+#include <sys/socket.h>
 
 #include <routeros_version.h>
 
@@ -64,6 +66,16 @@ typedef struct ros_reply_s ros_reply_t;
 typedef int (*ros_reply_handler_t) (ros_connection_t *c, const ros_reply_t *r,
 		void *user_data);
 
+/* Receives the value of a large "=key=value" word in chunks, as it arrives.
+ * "offset" is the position of "data" within the value, which is "length" bytes
+ * long in total. See word_sink in ros_query_options_t. */
+typedef int (*ros_word_sink_t) (ros_connection_t *c, const char *key,
+		const char *data, size_t data_len, size_t offset, size_t length,
+		void *user_data);
+
+struct ros_host_cache_s;
+typedef struct ros_host_cache_s ros_host_cache_t;
+
 /*
  * Connect options struct
  */
@@ -73,9 +85,42 @@ struct ros_connect_opts_s
 	unsigned int receive_timeout;
 	/* connect_timeout is the connect timeout in seconds. */
 	unsigned int connect_timeout;
+	/* If zero_copy is true, reply keys and values point directly into the
+	 * connection's receive buffer instead of being copied. */
+	_Bool zero_copy;
+	/* query_timeout is the time in seconds a blocking query may take as a
+	 * whole. Zero means no limit. */
+	unsigned int query_timeout;
+	/* If host_cache is not NULL, the login method and address family of each
+	 * host are remembered there, see "Host cache" below. */
+	ros_host_cache_t *host_cache;
+	/* Limits on the replies of a single query, guarding against running out
+	 * of memory. max_reply_sentences and max_reply_bytes limit the sentences
+	 * buffered for a (non-streaming) query, not counting the final "!done",
+	 * max_word_size the length of any one word. A query exceeding a limit
+	 * fails with EMSGSIZE; the rest of its reply is discarded. Zero means no
+	 * limit. */
+	size_t max_reply_sentences;
+	size_t max_reply_bytes;
+	size_t max_word_size;
 };
 typedef struct ros_connect_opts_s ros_connect_opts_t;
 
+/* Host cache {{{ */
+/* Remembers which login method each host needs, so that later connects skip
+ * the detection and can send the first commands together with the login, and
+ * which address family worked, so that it is tried first. Resolved addresses
+ * are re-used for "address_ttl" seconds; zero disables this. May be shared by
+ * several threads. */
+ros_host_cache_t *ros_host_cache_create (unsigned int address_ttl);
+void ros_host_cache_destroy (ros_host_cache_t *hc);
+/* Adds the entries of a file written by ros_host_cache_save to the cache.
+ * Returns ENOENT if the file does not exist. */
+int ros_host_cache_load (ros_host_cache_t *hc, const char *file);
+/* Writes the cache to "file", replacing it atomically. */
+int ros_host_cache_save (ros_host_cache_t *hc, const char *file);
+/* }}} Host cache */
+
 /*
  * Connection handling
  */
@@ -83,8 +128,100 @@ ros_connection_t *ros_connect (const char *node, const char *service,
 		const char *username, const char *password);
 ros_connection_t *ros_connect_with_options (const char *node, const char *service,
 		const char *username, const char *password, const ros_connect_opts_t *connect_opts);
+/* Connects to "addr" without resolving a host name. */
+ros_connection_t *ros_connect_addr (const struct sockaddr *addr, socklen_t addr_len,
+		const char *username, const char *password, const ros_connect_opts_t *connect_opts);
 int ros_disconnect (ros_connection_t *con);
 
+/*
+ * Non-blocking operation
+ */
+#define ROS_WANT_READ  0x01
+#define ROS_WANT_WRITE 0x02
+
+#define ROS_STATE_CONNECTING 1
+#define ROS_STATE_LOGIN      2
+#define ROS_STATE_READY      3
+#define ROS_STATE_FAILED     4
+
+/* Starts connecting without blocking. The connection has to be driven by
+ * calling ros_connection_process whenever the file descriptor returned by
+ * ros_connection_fd is ready for the events returned by
+ * ros_connection_events. The file descriptor may change while the connection
+ * is in the ROS_STATE_CONNECTING state. */
+ros_connection_t *ros_connect_start (const char *node, const char *service,
+		const char *username, const char *password, const ros_connect_opts_t *connect_opts);
+int ros_connection_fd (const ros_connection_t *c);
+int ros_connection_events (const ros_connection_t *c);
+int ros_connection_state (const ros_connection_t *c);
+int ros_connection_process (ros_connection_t *c, int events);
+
+/*
+ * Query filters
+ */
+/* A filter is a sequence of query words, such as "?name=ether1", which is
+ * encoded once and can then be attached to any number of queries. The
+ * operators are applied to the results of the preceding words, see the
+ * RouterOS API documentation of "?#". */
+struct ros_filter_s;
+typedef struct ros_filter_s ros_filter_t;
+
+ros_filter_t *ros_filter_create (void);
+void ros_filter_destroy (ros_filter_t *f);
+
+/* "?key=value": the property is equal to "value". */
+int ros_filter_equal (ros_filter_t *f, const char *key, const char *value);
+/* "?<key=value" and "?>key=value": the property is less / greater than
+ * "value". */
+int ros_filter_less (ros_filter_t *f, const char *key, const char *value);
+int ros_filter_greater (ros_filter_t *f, const char *key, const char *value);
+/* "?key" and "?-key": the property is present / absent. */
+int ros_filter_has (ros_filter_t *f, const char *key);
+int ros_filter_has_not (ros_filter_t *f, const char *key);
+/* "?#ops": "ops" is a sequence of the operators '|' (or), '&' (and), '!' (not)
+ * and '.' (duplicate the last result). */
+int ros_filter_operations (ros_filter_t *f, const char *ops);
+
+/*
+ * Prepared commands
+ */
+/* The command and its fixed arguments are encoded once by ros_prepare. When
+ * sending, only the variable arguments and the tag need to be encoded. */
+struct ros_prepared_s;
+typedef struct ros_prepared_s ros_prepared_t;
+
+ros_prepared_t *ros_prepare (const char *command,
+		size_t args_num, const char * const *args);
+void ros_prepared_destroy (ros_prepared_t *p);
+
+/*
+ * Query options
+ */
+struct ros_query_options_s
+{
+	/* Only used by the high-level functions: Bitmask of their ROS_*_FIELD_*
+	 * flags. Only the selected properties are requested from the device using
+	 * ".proplist"; all other members are set to their default values. Zero
+	 * requests all properties. */
+	uint64_t fields;
+
+	/* If not NULL, the filter's query words are appended to the command. */
+	const ros_filter_t *filter;
+
+	/* Time in seconds the query may take, overriding the query_timeout of the
+	 * connect options. Zero uses the connection's default. */
+	unsigned int timeout;
+
+	/* If word_sink is not NULL, values in the reply longer than
+	 * word_sink_threshold bytes are passed to it in chunks instead of being
+	 * buffered. In the reply, the key of such a value is present with an
+	 * empty value. */
+	ros_word_sink_t word_sink;
+	void *word_sink_data;
+	size_t word_sink_threshold;
+};
+typedef struct ros_query_options_s ros_query_options_t;
+
 /* 
  * Command execution
  */
@@ -92,6 +229,158 @@ int ros_query (ros_connection_t *c,
 		const char *command,
 		size_t args_num, const char * const *args,
 		ros_reply_handler_t handler, void *user_data);
+/* Like ros_query, but calls the handler once for each sentence as it is
+ * received. */
+int ros_query_stream (ros_connection_t *c,
+		const char *command,
+		size_t args_num, const char * const *args,
+		ros_reply_handler_t handler, void *user_data);
+
+/* Pipelining: ros_query_start sends a command without waiting for the reply.
+ * Replies are matched to their command using the ".tag" attribute and the
+ * handlers are called from within ros_query_wait, which waits until all
+ * outstanding commands have been answered. */
+int ros_query_start (ros_connection_t *c,
+		const char *command,
+		size_t args_num, const char * const *args,
+		ros_reply_handler_t handler, void *user_data);
+int ros_query_wait (ros_connection_t *c);
+
+/* Like ros_query and ros_query_start, with options. "opts" may be NULL. */
+int ros_query_with_options (ros_connection_t *c,
+		const char *command,
+		size_t args_num, const char * const *args,
+		ros_reply_handler_t handler, void *user_data,
+		const ros_query_options_t *opts);
+int ros_query_start_with_options (ros_connection_t *c,
+		const char *command,
+		size_t args_num, const char * const *args,
+		ros_reply_handler_t handler, void *user_data,
+		const ros_query_options_t *opts);
+
+/* Like ros_query and ros_query_start, but send a prepared command. The
+ * "args_num" arguments in "args" are appended to its fixed arguments. */
+int ros_query_prepared (ros_connection_t *c,
+		const ros_prepared_t *prepared,
+		size_t args_num, const char * const *args,
+		ros_reply_handler_t handler, void *user_data);
+int ros_query_prepared_start (ros_connection_t *c,
+		const ros_prepared_t *prepared,
+		size_t args_num, const char * const *args,
+		ros_reply_handler_t handler, void *user_data);
+
+/* Batches: ros_query_batch sends all commands using a single write and then
+ * waits for all replies, calling the handlers as the replies complete. */
+struct ros_batch_entry_s
+{
+	/* Either "command" or "prepared" must be set. */
+	const char *command;
+	const ros_prepared_t *prepared;
+	size_t args_num;
+	const char * const *args;
+	/* May be NULL. */
+	const ros_filter_t *filter;
+
+	ros_reply_handler_t handler;
+	void *user_data;
+
+	/* Set by ros_query_batch: the value returned by the handler or an error
+	 * code. */
+	int status;
+};
+typedef struct ros_batch_entry_s ros_batch_entry_t;
+
+/* Returns the first non-zero status of the entries. */
+int ros_query_batch (ros_connection_t *c,
+		ros_batch_entry_t *entries, size_t entries_num);
+/* Connects like ros_connect_with_options and runs the batch. If the host
+ * cache knows the host, the commands are sent right behind the login, so that
+ * the first data arrives after a single round trip. Returns NULL if
+ * connecting or logging in fails; the status of the entries is set in any
+ * case. */
+ros_connection_t *ros_connect_batch (const char *node, const char *service,
+		const char *username, const char *password,
+		const ros_connect_opts_t *connect_opts,
+		ros_batch_entry_t *entries, size_t entries_num);
+/* Returns the number of commands whose reply is not complete yet. */
+int ros_query_pending (const ros_connection_t *c);
+
+/* Subscriptions: commands such as "/interface/listen" or "print" with
+ * "=follow=" send a "!re" sentence for every change until they are cancelled.
+ * The handler is called for each sentence from within ros_query_wait,
+ * ros_connection_process or any other query function. */
+int ros_subscribe (ros_connection_t *c,
+		const char *command,
+		size_t args_num, const char * const *args,
+		ros_reply_handler_t handler, void *user_data,
+		unsigned int *ret_tag);
+/* Cancels the subscription identified by "tag". */
+int ros_cancel (ros_connection_t *c, unsigned int tag);
+
+/*
+ * Querying many devices from one thread
+ */
+struct ros_fleet_s;
+typedef struct ros_fleet_s ros_fleet_t;
+
+struct ros_fleet_host_s;
+typedef struct ros_fleet_host_s ros_fleet_host_t;
+
+/* Called once per host and run, after all of its commands have been answered
+ * or the host has failed. */
+typedef void (*ros_fleet_done_handler_t) (const char *node, int status,
+		void *user_data);
+
+ros_fleet_t *ros_fleet_create (const ros_connect_opts_t *connect_opts,
+		unsigned int max_connections);
+ros_fleet_host_t *ros_fleet_add_host (ros_fleet_t *f,
+		const char *node, const char *service,
+		const char *username, const char *password,
+		ros_fleet_done_handler_t done_handler, void *user_data);
+int ros_fleet_add_query (ros_fleet_host_t *h,
+		const char *command,
+		size_t args_num, const char * const *args,
+		ros_reply_handler_t handler, void *user_data);
+int ros_fleet_run (ros_fleet_t *f);
+int ros_fleet_destroy (ros_fleet_t *f);
+
+/*
+ * Connection pool
+ */
+struct ros_pool_s;
+typedef struct ros_pool_s ros_pool_t;
+
+/* Idle connections are checked before they are handed out again if they have
+ * not been used for "probe_interval" seconds. At most "max_idle" idle
+ * connections are kept per device; zero means no limit. */
+ros_pool_t *ros_pool_create (const ros_connect_opts_t *connect_opts,
+		unsigned int probe_interval, unsigned int max_idle);
+ros_connection_t *ros_pool_get (ros_pool_t *p,
+		const char *node, const char *service,
+		const char *username, const char *password);
+int ros_pool_put (ros_pool_t *p, ros_connection_t *c);
+int ros_pool_maintain (ros_pool_t *p);
+int ros_pool_destroy (ros_pool_t *p);
+
+/*
+ * I/O statistics
+ */
+struct ros_query_stats_s
+{
+	/* Number of read(2) and write(2) calls issued. */
+	uint64_t read_calls;
+	uint64_t write_calls;
+	/* Number of bytes received from and sent to the device. */
+	uint64_t bytes_received;
+	uint64_t bytes_sent;
+};
+typedef struct ros_query_stats_s ros_query_stats_t;
+
+/* Statistics since the connection has been established. */
+int ros_connection_stats (const ros_connection_t *c, ros_query_stats_t *ret);
+/* Statistics of the most recent query, including the queries issued from
+ * within its reply handler. */
+int ros_query_stats (const ros_connection_t *c, ros_query_stats_t *ret);
 
 /* 
  * Reply handling
@@ -147,6 +436,38 @@ typedef int (*ros_interface_handler_t) (ros_connection_t *c,
 
 int ros_interface (ros_connection_t *c,
 		ros_interface_handler_t handler, void *user_data);
+
+/* Same as above, but the interfaces are passed as one contiguous array. */
+typedef int (*ros_interface_array_handler_t) (ros_connection_t *c,
+		const ros_interface_t *i, size_t i_num, void *user_data);
+
+int ros_interface_array (ros_connection_t *c,
+		ros_interface_array_handler_t handler, void *user_data);
+
+/* Flags for the "fields" member of ros_query_options_t */
+#define ROS_INTERFACE_FIELD_NAME       (((uint64_t) 1) << 0)
+#define ROS_INTERFACE_FIELD_TYPE       (((uint64_t) 1) << 1)
+#define ROS_INTERFACE_FIELD_COMMENT    (((uint64_t) 1) << 2)
+#define ROS_INTERFACE_FIELD_RX_PACKETS (((uint64_t) 1) << 3)
+#define ROS_INTERFACE_FIELD_TX_PACKETS (((uint64_t) 1) << 4)
+#define ROS_INTERFACE_FIELD_RX_BYTES   (((uint64_t) 1) << 5)
+#define ROS_INTERFACE_FIELD_TX_BYTES   (((uint64_t) 1) << 6)
+#define ROS_INTERFACE_FIELD_RX_ERRORS  (((uint64_t) 1) << 7)
+#define ROS_INTERFACE_FIELD_TX_ERRORS  (((uint64_t) 1) << 8)
+#define ROS_INTERFACE_FIELD_RX_DROPS   (((uint64_t) 1) << 9)
+#define ROS_INTERFACE_FIELD_TX_DROPS   (((uint64_t) 1) << 10)
+#define ROS_INTERFACE_FIELD_MTU        (((uint64_t) 1) << 11)
+#define ROS_INTERFACE_FIELD_L2MTU      (((uint64_t) 1) << 12)
+#define ROS_INTERFACE_FIELD_DYNAMIC    (((uint64_t) 1) << 13)
+#define ROS_INTERFACE_FIELD_RUNNING    (((uint64_t) 1) << 14)
+#define ROS_INTERFACE_FIELD_ENABLED    (((uint64_t) 1) << 15)
+
+int ros_interface_with_options (ros_connection_t *c,
+		ros_interface_handler_t handler, void *user_data,
+		const ros_query_options_t *opts);
+int ros_interface_array_with_options (ros_connection_t *c,
+		ros_interface_array_handler_t handler, void *user_data,
+		const ros_query_options_t *opts);
 /* }}} /interface */
 
 /* High-level function for accessing /interface/wireless/registration-table {{{ */
@@ -203,6 +524,46 @@ typedef int (*ros_registration_table_handler_t) (ros_connection_t *c,
 
 int ros_registration_table (ros_connection_t *c,
 		ros_registration_table_handler_t handler, void *user_data);
+
+/* Same as above, but the entries are passed as one contiguous array. */
+typedef int (*ros_registration_table_array_handler_t) (ros_connection_t *c,
+		const ros_registration_table_t *r, size_t r_num, void *user_data);
+
+int ros_registration_table_array (ros_connection_t *c,
+		ros_registration_table_array_handler_t handler, void *user_data);
+
+/* Flags for the "fields" member of ros_query_options_t */
+#define ROS_REGISTRATION_TABLE_FIELD_INTERFACE          (((uint64_t) 1) << 0)
+#define ROS_REGISTRATION_TABLE_FIELD_RADIO_NAME         (((uint64_t) 1) << 1)
+#define ROS_REGISTRATION_TABLE_FIELD_MAC_ADDRESS        (((uint64_t) 1) << 2)
+#define ROS_REGISTRATION_TABLE_FIELD_AP                 (((uint64_t) 1) << 3)
+#define ROS_REGISTRATION_TABLE_FIELD_WDS                (((uint64_t) 1) << 4)
+#define ROS_REGISTRATION_TABLE_FIELD_RX_RATE            (((uint64_t) 1) << 5)
+#define ROS_REGISTRATION_TABLE_FIELD_TX_RATE            (((uint64_t) 1) << 6)
+#define ROS_REGISTRATION_TABLE_FIELD_RX_PACKETS         (((uint64_t) 1) << 7)
+#define ROS_REGISTRATION_TABLE_FIELD_TX_PACKETS         (((uint64_t) 1) << 8)
+#define ROS_REGISTRATION_TABLE_FIELD_RX_BYTES           (((uint64_t) 1) << 9)
+#define ROS_REGISTRATION_TABLE_FIELD_TX_BYTES           (((uint64_t) 1) << 10)
+#define ROS_REGISTRATION_TABLE_FIELD_RX_FRAMES          (((uint64_t) 1) << 11)
+#define ROS_REGISTRATION_TABLE_FIELD_TX_FRAMES          (((uint64_t) 1) << 12)
+#define ROS_REGISTRATION_TABLE_FIELD_RX_FRAME_BYTES     (((uint64_t) 1) << 13)
+#define ROS_REGISTRATION_TABLE_FIELD_TX_FRAME_BYTES     (((uint64_t) 1) << 14)
+#define ROS_REGISTRATION_TABLE_FIELD_RX_HW_FRAMES       (((uint64_t) 1) << 15)
+#define ROS_REGISTRATION_TABLE_FIELD_TX_HW_FRAMES       (((uint64_t) 1) << 16)
+#define ROS_REGISTRATION_TABLE_FIELD_RX_HW_FRAME_BYTES  (((uint64_t) 1) << 17)
+#define ROS_REGISTRATION_TABLE_FIELD_TX_HW_FRAME_BYTES  (((uint64_t) 1) << 18)
+#define ROS_REGISTRATION_TABLE_FIELD_RX_SIGNAL_STRENGTH (((uint64_t) 1) << 19)
+#define ROS_REGISTRATION_TABLE_FIELD_TX_SIGNAL_STRENGTH (((uint64_t) 1) << 20)
+#define ROS_REGISTRATION_TABLE_FIELD_SIGNAL_TO_NOISE    (((uint64_t) 1) << 21)
+#define ROS_REGISTRATION_TABLE_FIELD_RX_CCQ             (((uint64_t) 1) << 22)
+#define ROS_REGISTRATION_TABLE_FIELD_TX_CCQ             (((uint64_t) 1) << 23)
+
+int ros_registration_table_with_options (ros_connection_t *c,
+		ros_registration_table_handler_t handler, void *user_data,
+		const ros_query_options_t *opts);
+int ros_registration_table_array_with_options (ros_connection_t *c,
+		ros_registration_table_array_handler_t handler, void *user_data,
+		const ros_query_options_t *opts);
 /* }}} /interface/wireless/registration-table */
 
 /* High-level function for accessing /system/resource {{{ */
@@ -238,6 +599,27 @@ typedef int (*ros_system_resource_handler_t) (ros_connection_t *c,
 
 int ros_system_resource (ros_connection_t *c,
 		ros_system_resource_handler_t handler, void *user_data);
+
+/* Flags for the "fields" member of ros_query_options_t */
+#define ROS_SYSTEM_RESOURCE_FIELD_UPTIME                  (((uint64_t) 1) << 0)
+#define ROS_SYSTEM_RESOURCE_FIELD_VERSION                 (((uint64_t) 1) << 1)
+#define ROS_SYSTEM_RESOURCE_FIELD_ARCHITECTURE_NAME       (((uint64_t) 1) << 2)
+#define ROS_SYSTEM_RESOURCE_FIELD_BOARD_NAME              (((uint64_t) 1) << 3)
+#define ROS_SYSTEM_RESOURCE_FIELD_CPU_MODEL               (((uint64_t) 1) << 4)
+#define ROS_SYSTEM_RESOURCE_FIELD_CPU_COUNT               (((uint64_t) 1) << 5)
+#define ROS_SYSTEM_RESOURCE_FIELD_CPU_LOAD                (((uint64_t) 1) << 6)
+#define ROS_SYSTEM_RESOURCE_FIELD_CPU_FREQUENCY           (((uint64_t) 1) << 7)
+#define ROS_SYSTEM_RESOURCE_FIELD_FREE_MEMORY             (((uint64_t) 1) << 8)
+#define ROS_SYSTEM_RESOURCE_FIELD_TOTAL_MEMORY            (((uint64_t) 1) << 9)
+#define ROS_SYSTEM_RESOURCE_FIELD_FREE_HDD_SPACE          (((uint64_t) 1) << 10)
+#define ROS_SYSTEM_RESOURCE_FIELD_TOTAL_HDD_SPACE         (((uint64_t) 1) << 11)
+#define ROS_SYSTEM_RESOURCE_FIELD_WRITE_SECT_SINCE_REBOOT (((uint64_t) 1) << 12)
+#define ROS_SYSTEM_RESOURCE_FIELD_WRITE_SECT_TOTAL        (((uint64_t) 1) << 13)
+#define ROS_SYSTEM_RESOURCE_FIELD_BAD_BLOCKS              (((uint64_t) 1) << 14)
+
+int ros_system_resource_with_options (ros_connection_t *c,
+		ros_system_resource_handler_t handler, void *user_data,
+		const ros_query_options_t *opts);
 /* }}} /system/resource */
 
 /* High-level function for accessing /system/health {{{ */
@@ -255,8 +637,82 @@ typedef int (*ros_system_health_handler_t) (ros_connection_t *c,
 
 int ros_system_health (ros_connection_t *c,
 		ros_system_health_handler_t handler, void *user_data);
+
+/* Flags for the "fields" member of ros_query_options_t */
+#define ROS_SYSTEM_HEALTH_FIELD_VOLTAGE     (((uint64_t) 1) << 0)
+#define ROS_SYSTEM_HEALTH_FIELD_TEMPERATURE (((uint64_t) 1) << 1)
+
+int ros_system_health_with_options (ros_connection_t *c,
+		ros_system_health_handler_t handler, void *user_data,
+		const ros_query_options_t *opts);
 /* }}} /system/health */
 
+/* Rate tracker {{{ */
+/* Keeps the previous sample of each interface (by name) and each
+ * registration table entry (by MAC address) and computes per-second rates
+ * from the counters. Not thread-safe. */
+struct ros_rate_tracker_s;
+typedef struct ros_rate_tracker_s ros_rate_tracker_t;
+
+struct ros_interface_rate_s;
+typedef struct ros_interface_rate_s ros_interface_rate_t;
+struct ros_interface_rate_s
+{
+	/* False for the first sample, after a counter reset and if the entry has no
+	 * name. All other fields are zero in that case. */
+	_Bool valid;
+	/* Seconds since the previous sample */
+	double interval;
+
+	/* Per second */
+	double rx_packets;
+	double tx_packets;
+	double rx_bytes;
+	double tx_bytes;
+	double rx_errors;
+	double tx_errors;
+	double rx_drops;
+	double tx_drops;
+};
+
+struct ros_registration_table_rate_s;
+typedef struct ros_registration_table_rate_s ros_registration_table_rate_t;
+struct ros_registration_table_rate_s
+{
+	_Bool valid;
+	double interval;
+
+	double rx_packets;
+	double tx_packets;
+	double rx_bytes;
+	double tx_bytes;
+	double rx_frames;
+	double tx_frames;
+	double rx_frame_bytes;
+	double tx_frame_bytes;
+	double rx_hw_frames;
+	double tx_hw_frames;
+	double rx_hw_frame_bytes;
+	double tx_hw_frame_bytes;
+};
+
+/* "counter_bits" is the width of the device's counters, 32 or 64. RouterOS
+ * reports 64 bit counters, which are reset rather than wrapped when they go
+ * backwards. Returns NULL and sets errno to EINVAL for other widths. */
+ros_rate_tracker_t *ros_rate_tracker_create (unsigned int counter_bits);
+/* Forgets entries that have not been updated for "max_age" seconds. */
+void ros_rate_tracker_purge (ros_rate_tracker_t *t, unsigned int max_age);
+void ros_rate_tracker_destroy (ros_rate_tracker_t *t);
+
+/* Stores the "i_num" interfaces of the array "i" as the current sample and
+ * writes their rates to the array "ret". */
+int ros_rate_interface (ros_rate_tracker_t *t,
+		const ros_interface_t *i, size_t i_num, ros_interface_rate_t *ret);
+int ros_rate_registration_table (ros_rate_tracker_t *t,
+		const ros_registration_table_t *r, size_t r_num,
+		ros_registration_table_rate_t *ret);
+/* }}} Rate tracker */
+
 #ifdef __cplusplus
 }
 #endif
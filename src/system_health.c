@@ -31,6 +31,7 @@
 #include "config.h"
 
 #include <stdlib.h>
+#include <stddef.h>
 #include <math.h>
 #include <errno.h>
 #include <string.h>
@@ -51,6 +52,15 @@ struct rt_internal_data_s
 };
 typedef struct rt_internal_data_s rt_internal_data_t;
 
+/* Sorted by key. */
+static const schema_field_t sh_fields[] =
+{
+	SCHEMA_FIELD ("temperature", SCHEMA_DOUBLE, ros_system_health_t, temperature,
+			ROS_SYSTEM_HEALTH_FIELD_TEMPERATURE),
+	SCHEMA_FIELD ("voltage", SCHEMA_DOUBLE, ros_system_health_t, voltage,
+			ROS_SYSTEM_HEALTH_FIELD_VOLTAGE)
+};
+
 /*
  * Private functions
  */
@@ -63,8 +73,7 @@ static int rt_reply_to_system_health (const ros_reply_t *r, /* {{{ */
 	if (strcmp ("re", ros_reply_status (r)) != 0)
 		return (rt_reply_to_system_health (ros_reply_next (r), ret));
 
-	ret->voltage = sstrtod (ros_reply_param_val_by_key (r, "voltage"));
-	ret->temperature = sstrtod (ros_reply_param_val_by_key (r, "temperature"));
+	schema_decode (r, sh_fields, sizeof (sh_fields) / sizeof (sh_fields[0]), ret);
 
 	return (0);
 } /* }}} int rt_reply_to_system_health */
@@ -88,11 +97,26 @@ static int sh_internal_handler (ros_connection_t *c, /* {{{ */
 	return (status);
 } /* }}} int sh_internal_handler */
 
+/* Used by test_parse to check the table. */
+const schema_field_t *sh_schema (size_t *ret_num) /* {{{ */
+{
+	*ret_num = sizeof (sh_fields) / sizeof (sh_fields[0]);
+	return (sh_fields);
+} /* }}} const schema_field_t *sh_schema */
+
 /*
  * Public functions
  */
 int ros_system_health (ros_connection_t *c, /* {{{ */
 		ros_system_health_handler_t handler, void *user_data)
+{
+	return (ros_system_health_with_options (c, handler, user_data,
+				/* opts = */ NULL));
+} /* }}} int ros_system_health */
+
+int ros_system_health_with_options (ros_connection_t *c, /* {{{ */
+		ros_system_health_handler_t handler, void *user_data,
+		const ros_query_options_t *opts)
 {
 	rt_internal_data_t data;
 
@@ -102,9 +126,9 @@ int ros_system_health (ros_connection_t *c, /* {{{ */
 	data.handler = handler;
 	data.user_data = user_data;
 
-	return (ros_query (c, "/system/health/print",
-				/* args_num = */ 0, /* args = */ NULL,
+	return (schema_query (c, "/system/health/print",
+				sh_fields, sizeof (sh_fields) / sizeof (sh_fields[0]), opts,
 				sh_internal_handler, &data));
-} /* }}} int ros_system_health */
+} /* }}} int ros_system_health_with_options */
 
 /* vim: set ts=2 sw=2 noet fdm=marker : */
@@ -29,6 +29,7 @@
 #include "config.h"
 
 #include <stdlib.h>
+#include <stddef.h>
 #include <math.h>
 #include <errno.h>
 #include <string.h>
@@ -49,6 +50,49 @@ struct rt_internal_data_s
 };
 typedef struct rt_internal_data_s rt_internal_data_t;
 
+/* Sorted by key. */
+static const schema_field_t sr_fields[] =
+{
+	SCHEMA_FIELD ("architecture-name", SCHEMA_STRING, ros_system_resource_t,
+			architecture_name,
+			ROS_SYSTEM_RESOURCE_FIELD_ARCHITECTURE_NAME),
+	SCHEMA_FIELD ("bad-blocks", SCHEMA_UINT64, ros_system_resource_t, bad_blocks,
+			ROS_SYSTEM_RESOURCE_FIELD_BAD_BLOCKS),
+	SCHEMA_FIELD ("board-name", SCHEMA_STRING, ros_system_resource_t, board_name,
+			ROS_SYSTEM_RESOURCE_FIELD_BOARD_NAME),
+	SCHEMA_FIELD ("cpu", SCHEMA_STRING, ros_system_resource_t, cpu_model,
+			ROS_SYSTEM_RESOURCE_FIELD_CPU_MODEL),
+	SCHEMA_FIELD ("cpu-count", SCHEMA_UINT, ros_system_resource_t, cpu_count,
+			ROS_SYSTEM_RESOURCE_FIELD_CPU_COUNT),
+	SCHEMA_FIELD ("cpu-frequency", SCHEMA_UINT64, ros_system_resource_t,
+			cpu_frequency,
+			ROS_SYSTEM_RESOURCE_FIELD_CPU_FREQUENCY),
+	SCHEMA_FIELD ("cpu-load", SCHEMA_UINT, ros_system_resource_t, cpu_load,
+			ROS_SYSTEM_RESOURCE_FIELD_CPU_LOAD),
+	SCHEMA_FIELD ("free-hdd-space", SCHEMA_UINT64, ros_system_resource_t,
+			free_hdd_space,
+			ROS_SYSTEM_RESOURCE_FIELD_FREE_HDD_SPACE),
+	SCHEMA_FIELD ("free-memory", SCHEMA_UINT64, ros_system_resource_t,
+			free_memory,
+			ROS_SYSTEM_RESOURCE_FIELD_FREE_MEMORY),
+	SCHEMA_FIELD ("total-hdd-space", SCHEMA_UINT64, ros_system_resource_t,
+			total_hdd_space,
+			ROS_SYSTEM_RESOURCE_FIELD_TOTAL_HDD_SPACE),
+	SCHEMA_FIELD ("total-memory", SCHEMA_UINT64, ros_system_resource_t,
+			total_memory,
+			ROS_SYSTEM_RESOURCE_FIELD_TOTAL_MEMORY),
+	SCHEMA_FIELD ("uptime", SCHEMA_DATE, ros_system_resource_t, uptime,
+			ROS_SYSTEM_RESOURCE_FIELD_UPTIME),
+	SCHEMA_FIELD ("version", SCHEMA_STRING, ros_system_resource_t, version,
+			ROS_SYSTEM_RESOURCE_FIELD_VERSION),
+	SCHEMA_FIELD ("write-sect-since-reboot", SCHEMA_UINT64, ros_system_resource_t,
+			write_sect_since_reboot,
+			ROS_SYSTEM_RESOURCE_FIELD_WRITE_SECT_SINCE_REBOOT),
+	SCHEMA_FIELD ("write-sect-total", SCHEMA_UINT64, ros_system_resource_t,
+			write_sect_total,
+			ROS_SYSTEM_RESOURCE_FIELD_WRITE_SECT_TOTAL)
+};
+
 /*
  * Private functions
  */
@@ -61,26 +105,10 @@ static int rt_reply_to_system_resource (const ros_reply_t *r, /* {{{ */
 	if (strcmp ("re", ros_reply_status (r)) != 0)
 		return (rt_reply_to_system_resource (ros_reply_next (r), ret));
 
-	ret->uptime = sstrtodate (ros_reply_param_val_by_key (r, "uptime"));
-
-	ret->version = ros_reply_param_val_by_key (r, "version");
-	ret->architecture_name = ros_reply_param_val_by_key (r, "architecture-name");
-	ret->board_name = ros_reply_param_val_by_key (r, "board-name");
-
-	ret->cpu_model = ros_reply_param_val_by_key (r, "cpu");
-	ret->cpu_count = sstrtoui (ros_reply_param_val_by_key (r, "cpu-count"));
-	ret->cpu_load = sstrtoui (ros_reply_param_val_by_key (r, "cpu-load"));
-	ret->cpu_frequency = sstrtoui64 (ros_reply_param_val_by_key (r, "cpu-frequency")) * 1000000;
-
-	ret->free_memory = sstrtoui64 (ros_reply_param_val_by_key (r, "free-memory"));
-	ret->total_memory = sstrtoui64 (ros_reply_param_val_by_key (r, "total-memory"));
-
-	ret->free_hdd_space = sstrtoui64 (ros_reply_param_val_by_key (r, "free-hdd-space"));
-	ret->total_hdd_space = sstrtoui64 (ros_reply_param_val_by_key (r, "total-hdd-space"));
+	schema_decode (r, sr_fields, sizeof (sr_fields) / sizeof (sr_fields[0]), ret);
 
-	ret->write_sect_since_reboot = sstrtoui64 (ros_reply_param_val_by_key (r, "write-sect-since-reboot"));
-	ret->write_sect_total = sstrtoui64 (ros_reply_param_val_by_key (r, "write-sect-total"));
-	ret->bad_blocks = sstrtoui64 (ros_reply_param_val_by_key (r, "bad-blocks"));
+	/* Reported in MHz. */
+	ret->cpu_frequency *= 1000000;
 
 	return (0);
 } /* }}} int rt_reply_to_system_resource */
@@ -104,11 +132,26 @@ static int sr_internal_handler (ros_connection_t *c, /* {{{ */
 	return (status);
 } /* }}} int sr_internal_handler */
 
+/* Used by test_parse to check the table. */
+const schema_field_t *sr_schema (size_t *ret_num) /* {{{ */
+{
+	*ret_num = sizeof (sr_fields) / sizeof (sr_fields[0]);
+	return (sr_fields);
+} /* }}} const schema_field_t *sr_schema */
+
 /*
  * Public functions
  */
 int ros_system_resource (ros_connection_t *c, /* {{{ */
 		ros_system_resource_handler_t handler, void *user_data)
+{
+	return (ros_system_resource_with_options (c, handler, user_data,
+				/* opts = */ NULL));
+} /* }}} int ros_system_resource */
+
+int ros_system_resource_with_options (ros_connection_t *c, /* {{{ */
+		ros_system_resource_handler_t handler, void *user_data,
+		const ros_query_options_t *opts)
 {
 	rt_internal_data_t data;
 
@@ -118,9 +161,9 @@ int ros_system_resource (ros_connection_t *c, /* {{{ */
 	data.handler = handler;
 	data.user_data = user_data;
 
-	return (ros_query (c, "/system/resource/print",
-				/* args_num = */ 0, /* args = */ NULL,
+	return (schema_query (c, "/system/resource/print",
+				sr_fields, sizeof (sr_fields) / sizeof (sr_fields[0]), opts,
 				sr_internal_handler, &data));
-} /* }}} int ros_system_resource */
+} /* }}} int ros_system_resource_with_options */
 
 /* vim: set ts=2 sw=2 noet fdm=marker : */
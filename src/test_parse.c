@@ -0,0 +1,282 @@
+/**
+ * librouteros - src/test_parse.c
+ * Copyright (C) 2026  agent
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+ * OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ *
+ * Authors:
+ *   agent <agent at local>
+ **/
+
+/* Checks the number and duration parsers against the versions without fast
+ * paths in ros_parse_ref.c and that the schema tables are sorted. Run by
+ * "make check". */
+
+#ifndef _ISOC99_SOURCE
+# define _ISOC99_SOURCE
+#endif
+
+#ifndef _POSIX_C_SOURCE
+# define _POSIX_C_SOURCE 200112L
+#endif
+
+#include "config.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <stddef.h>
+#include <string.h>
+#include <math.h>
+#include <errno.h>
+#include <locale.h>
+
+#include "routeros_api.h"
+#include "ros_parse.h"
+#include "ros_parse_ref.h"
+
+static const char *test_inputs[] =
+{
+	"0", "-0", "1", "-1", "+1", "-74", "58.5", "58.5Mbps", "52.0Mbps-HT",
+	"0.5", ".5", "-.5", "5.", "-", ".", "-.", "", " 1", "abc", "1,5",
+	"123456789012345", "1234567890123456", "12345678901234567890",
+	"0.000000000000001", "99999999999999.9", "9999999999999.99",
+	"0.1", "0.2", "0.3", "3.14159265358979", "2.718281828459045",
+	"1e5", "1E5", "-1e-5", "1.5e", "1.5e+", "1e308", "1e309", "-1e309",
+	"1e-400", "4.9e-324", "0x10", "0X1p3", "1p3", "inf", "-inf", "nan",
+	"infinity", "18446744073709551615", "18446744073709551616",
+	"100000000000000000000000", "007", "00.70", "-00.0070",
+};
+
+static const char *date_inputs[] =
+{
+	"6w6d18:33:07", "1y2w3d4h5m6s", "1d", "18:33:07", "33:07", "07", "5m30s",
+	"", "abc", "d", "5d m", "5dm", "1d2x3s", "1d:", "::", "12:", "-1d",
+	" 1d", "1d 2h", "18446744073709551615s", "18446744073709551616s",
+	"1d18446744073709551616s", "99999999999y", "007s",
+};
+
+static const char *rx_tx_inputs[] =
+{
+	"1234/5678", "0/0", "1234,5678", "1234", "1234 5678", "1234/", "/5678",
+	"", "abc", "1234/abc", " 1234/5678", "1234/ 5678", "1234/-1", "-1/1",
+	"18446744073709551615/18446744073709551615",
+	"18446744073709551616/1", "1/18446744073709551616", "1/2/3", "1//2",
+};
+
+/* Compares bit patterns, so that NAN equals NAN and 0.0 differs from -0.0. */
+static _Bool double_same (double a, double b) /* {{{ */
+{
+	if (isnan (a) || isnan (b))
+		return (isnan (a) && isnan (b));
+
+	return (memcmp (&a, &b, sizeof (a)) == 0);
+} /* }}} _Bool double_same */
+
+static int check_one (const char *str) /* {{{ */
+{
+	double d_got = sstrtod (str);
+	double d_want = reference_strtod (str);
+	uint64_t u_got = sstrtoui64 (str);
+	uint64_t u_want = reference_strtoui64 (str);
+	int errors = 0;
+
+	if (!double_same (d_got, d_want))
+	{
+		printf ("FAIL: sstrtod (\"%s\") = %.17g, strtod: %.17g\n",
+				str, d_got, d_want);
+		errors++;
+	}
+
+	if (u_got != u_want)
+	{
+		printf ("FAIL: sstrtoui64 (\"%s\") = %"PRIu64", strtoull: %"PRIu64"\n",
+				str, u_got, u_want);
+		errors++;
+	}
+
+	return (errors);
+} /* }}} int check_one */
+
+static int check_date (const char *str) /* {{{ */
+{
+	uint64_t got = sstrtodate (str);
+	uint64_t want = reference_strtodate (str, /* have_hour = */ 0);
+
+	if (got != want)
+	{
+		printf ("FAIL: sstrtodate (\"%s\") = %"PRIu64", reference: %"PRIu64"\n",
+				str, got, want);
+		return (1);
+	}
+
+	return (0);
+} /* }}} int check_date */
+
+static int check_rx_tx (const char *str) /* {{{ */
+{
+	uint64_t rx_got, tx_got;
+	uint64_t rx_want, tx_want;
+	int status_got;
+	int status_want;
+
+	status_got = sstrto_rx_tx_counters (str, &rx_got, &tx_got);
+	status_want = reference_strto_rx_tx_counters (str, &rx_want, &tx_want);
+
+	if ((status_got != status_want) || (rx_got != rx_want)
+			|| (tx_got != tx_want))
+	{
+		printf ("FAIL: sstrto_rx_tx_counters (\"%s\") = %i %"PRIu64"/%"PRIu64", "
+				"reference: %i %"PRIu64"/%"PRIu64"\n", str,
+				status_got, rx_got, tx_got, status_want, rx_want, tx_want);
+		return (1);
+	}
+
+	return (0);
+} /* }}} int check_rx_tx */
+
+/* Builds a random string from the characters in "alphabet". */
+static void random_input (char *buffer, size_t buffer_size, /* {{{ */
+		const char *alphabet)
+{
+	size_t alphabet_len = strlen (alphabet);
+	size_t len;
+	size_t i;
+
+	len = 1 + ((size_t) rand () % (buffer_size - 1));
+	for (i = 0; i < len - 1; i++)
+		buffer[i] = alphabet[(size_t) rand () % alphabet_len];
+	buffer[len - 1] = 0;
+} /* }}} void random_input */
+
+/* schema_decode uses bsearch(3), so a table which is not strictly sorted
+ * would silently fail to decode some of its keys. */
+static int check_schema (const char *name, /* {{{ */
+		const schema_field_t *fields, size_t fields_num)
+{
+	int errors = 0;
+	size_t i;
+
+	if (fields_num > 64)
+	{
+		printf ("FAIL: %s has %zu fields, at most 64 are supported\n",
+				name, fields_num);
+		errors++;
+	}
+
+	for (i = 1; i < fields_num; i++)
+	{
+		if (strcmp (fields[i - 1].key, fields[i].key) < 0)
+			continue;
+
+		printf ("FAIL: %s: \"%s\" is not sorted before \"%s\"\n",
+				name, fields[i - 1].key, fields[i].key);
+		errors++;
+	}
+
+	return (errors);
+} /* }}} int check_schema */
+
+static int check_schemas (void) /* {{{ */
+{
+	const schema_field_t *fields;
+	size_t fields_num;
+	char proplist[256];
+	int errors = 0;
+
+	fields = if_schema (&fields_num);
+	errors += check_schema ("if_fields", fields, fields_num);
+	fields = rt_schema (&fields_num);
+	errors += check_schema ("rt_fields", fields, fields_num);
+	fields = sr_schema (&fields_num);
+	errors += check_schema ("sr_fields", fields, fields_num);
+	fields = sh_schema (&fields_num);
+	errors += check_schema ("sh_fields", fields, fields_num);
+
+	/* Old versions only report the combined "bytes" together with "packets",
+	 * which is therefore needed to decode it. */
+	fields = if_schema (&fields_num);
+	if ((schema_proplist (fields, fields_num, ROS_INTERFACE_FIELD_RX_BYTES,
+					proplist, sizeof (proplist)) != 0)
+			|| (strcmp ("=.proplist=bytes,packets,rx-byte", proplist) != 0))
+	{
+		printf ("FAIL: proplist of rx_bytes: %s\n", proplist);
+		errors++;
+	}
+
+	return (errors);
+} /* }}} int check_schemas */
+
+static int check_all (void) /* {{{ */
+{
+	char buffer[32];
+	int errors = 0;
+	size_t i;
+
+	for (i = 0; i < sizeof (test_inputs) / sizeof (test_inputs[0]); i++)
+		errors += check_one (test_inputs[i]);
+	for (i = 0; i < sizeof (date_inputs) / sizeof (date_inputs[0]); i++)
+		errors += check_date (date_inputs[i]);
+	for (i = 0; i < sizeof (rx_tx_inputs) / sizeof (rx_tx_inputs[0]); i++)
+		errors += check_rx_tx (rx_tx_inputs[i]);
+
+	srand (42);
+	for (i = 0; i < 1000000; i++)
+	{
+		random_input (buffer, sizeof (buffer), "0123456789000000000.-+eE");
+		errors += check_one (buffer);
+		random_input (buffer, sizeof (buffer), "0123456789ywdhms:: x");
+		errors += check_date (buffer);
+		random_input (buffer, sizeof (buffer), "0123456789//,- ");
+		errors += check_rx_tx (buffer);
+	}
+
+	return (errors);
+} /* }}} int check_all */
+
+int main (void) /* {{{ */
+{
+	/* Locales using a decimal comma, if one is installed. */
+	static const char *locales[] = { "de_DE.UTF-8", "de_DE.utf8", "de_DE",
+		"fr_FR.UTF-8", "fr_FR.utf8", "fr_FR" };
+	int errors;
+	size_t i;
+
+	errors = check_schemas ();
+	errors += check_all ();
+
+	for (i = 0; i < sizeof (locales) / sizeof (locales[0]); i++)
+	{
+		if (setlocale (LC_NUMERIC, locales[i]) == NULL)
+			continue;
+
+		printf ("Checking with LC_NUMERIC=%s\n", locales[i]);
+		errors += check_all ();
+		errors += check_one ("58,5");
+		break;
+	}
+	if (i >= sizeof (locales) / sizeof (locales[0]))
+		printf ("No locale with a decimal comma installed; skipped.\n");
+
+	if (errors != 0)
+	{
+		printf ("%i error(s)\n", errors);
+		return (1);
+	}
+
+	printf ("All tests passed.\n");
+	return (0);
+} /* }}} int main */
+
+/* vim: set ts=2 sw=2 noet fdm=marker : */